@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btree.h"
+#include "common.h"
+#include "executor.h"
+#include "pager.h"
+#include "scan.h"
+
+/*
+Microbenchmarks for the storage engine, run by `make bench`. Each table size
+given on the command line (or each default size) gets a fresh database in a
+temporary directory, built by sequential and then random inserts, and the
+sequential one is then read back every way the engine reads. Every operation
+is timed on its own, and each benchmark prints one tab-separated line:
+
+  name  rows  ops  ops_per_sec  p50_ns  p99_ns  p999_ns
+
+after a header naming the columns, so runs from two commits can be joined on
+name and rows and compared. ops_per_sec counts only the time spent inside the
+timed operations. Misses in the buffer pool are served from the OS page cache,
+not the disk.
+*/
+
+/**
+ * @brief Table sizes benchmarked when none are given.
+ */
+static const uint32_t BENCH_DEFAULT_SIZES[] = {10000, 100000, 1000000};
+
+/**
+ * @brief Operations timed by each benchmark that does not touch every row.
+ */
+#define BENCH_OPS 100000
+
+/**
+ * @brief Full scans timed at each table size.
+ */
+#define BENCH_SCANS 10
+
+/**
+ * @brief Times each database is opened and closed.
+ */
+#define BENCH_OPENS 50
+
+/**
+ * @brief Pages read over and over by the buffer pool hit benchmark; few
+ * enough to stay resident in any pool.
+ */
+#define BENCH_HOT_PAGES 8
+
+typedef struct {
+  uint64_t* samples;  // nanoseconds per operation
+  uint32_t count;
+  uint32_t capacity;
+} Latencies;
+
+static uint64_t bench_seed = 0x2545f4914f6cdd1du;
+
+// xorshift64*, seeded the same on every run so runs see the same keys
+static uint32_t bench_random(uint32_t bound) {
+  bench_seed ^= bench_seed >> 12;
+  bench_seed ^= bench_seed << 25;
+  bench_seed ^= bench_seed >> 27;
+  return (uint32_t)((bench_seed * 0x2545f4914f6cdd1du) >> 32) % bound;
+}
+
+static uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void latencies_init(Latencies* latencies, uint32_t capacity) {
+  latencies->samples = malloc(capacity * sizeof(uint64_t));
+  latencies->count = 0;
+  latencies->capacity = capacity;
+}
+
+static void latencies_add(Latencies* latencies, uint64_t start) {
+  latencies->samples[latencies->count++] = bench_now() - start;
+}
+
+static int compare_samples(const void* a, const void* b) {
+  uint64_t sa = *(uint64_t*)a;
+  uint64_t sb = *(uint64_t*)b;
+
+  return (sa > sb) - (sa < sb);
+}
+
+static uint64_t percentile(Latencies* latencies, uint32_t per_mille) {
+  uint64_t idx = (uint64_t)latencies->count * per_mille / 1000;
+
+  return latencies->samples[idx < latencies->count ? idx
+                                                   : latencies->count - 1];
+}
+
+/**
+ * @brief Print a benchmark's line and free its samples.
+ */
+static void bench_report(const char* name, uint32_t rows,
+                         Latencies* latencies) {
+  uint64_t total = 0;
+
+  for (uint32_t i = 0; i < latencies->count; i++) {
+    total += latencies->samples[i];
+  }
+
+  qsort(latencies->samples, latencies->count, sizeof(uint64_t),
+        compare_samples);
+
+  printf("%s\t%u\t%u\t%.0f\t%lu\t%lu\t%lu\n", name, rows, latencies->count,
+         total ? latencies->count * 1e9 / total : 0.0,
+         (unsigned long)percentile(latencies, 500),
+         (unsigned long)percentile(latencies, 990),
+         (unsigned long)percentile(latencies, 999));
+  fflush(stdout);
+
+  free(latencies->samples);
+}
+
+static Table* bench_open(const char* filename, uint32_t num_frames) {
+  PagerOptions options = {
+      .mode = PAGER_MODE_BUFFERED,
+      .num_frames = num_frames,
+      .wal = true,
+  };
+
+  return db_open(filename, &options);
+}
+
+static void bench_remove(const char* filename) {
+  char wal[PATH_MAX + 8];
+
+  snprintf(wal, sizeof(wal), "%s-wal", filename);
+  unlink(filename);
+  unlink(wal);
+}
+
+/**
+ * @brief Insert ids one statement at a time through execute_insert, in one
+ * transaction so that commits do not drown out the tree.
+ */
+static void bench_insert(const char* name, const char* filename,
+                         uint32_t* ids, uint32_t rows) {
+  Table* table = bench_open(filename, PAGER_DEFAULT_FRAMES);
+  Row row;
+  Statement statement = {
+      .type = STATEMENT_INSERT,
+      .rows = &row,
+      .num_rows = 1,
+      .rows_capacity = 1,
+  };
+  Latencies latencies;
+
+  latencies_init(&latencies, rows);
+  pager_begin(table->pager);
+
+  for (uint32_t i = 0; i < rows; i++) {
+    row.id = ids[i];
+    snprintf(row.username, sizeof(row.username), "user%u", ids[i]);
+    snprintf(row.email, sizeof(row.email), "user%u@example.com", ids[i]);
+
+    uint64_t start = bench_now();
+    execute_insert(&statement, table);
+    latencies_add(&latencies, start);
+  }
+
+  pager_commit(table->pager);
+  db_close(table);
+  bench_report(name, rows, &latencies);
+}
+
+/**
+ * @brief Search single leaves for keys they hold, leaving out the descent.
+ */
+static void bench_leaf_node_find(Table* table, uint32_t rows) {
+  Latencies latencies;
+
+  latencies_init(&latencies, BENCH_OPS);
+
+  for (uint32_t i = 0; i < BENCH_OPS; i++) {
+    uint32_t key = 1 + bench_random(rows);
+    Cursor cursor;
+    table_find_by_key(table, key, &cursor);
+    uint32_t page_num = cursor.page_num;
+    void* node = get_page(table->pager, page_num);
+
+    uint64_t start = bench_now();
+    leaf_node_find(table, page_num, node, key, &cursor);
+    latencies_add(&latencies, start);
+  }
+
+  bench_report("leaf_node_find", rows, &latencies);
+}
+
+/**
+ * @brief Look up random ids the way a select does, latches and all.
+ */
+static void bench_point_lookup(Table* table, uint32_t rows) {
+  Latencies latencies;
+  Row row;
+
+  latencies_init(&latencies, BENCH_OPS);
+
+  for (uint32_t i = 0; i < BENCH_OPS; i++) {
+    uint32_t key = 1 + bench_random(rows);
+
+    Cursor cursor;
+
+    uint64_t start = bench_now();
+    table_scan(table, key, &cursor);
+    deserialize_row(cursor_value(&cursor), &row);
+    cursor_close(&cursor);
+    latencies_add(&latencies, start);
+
+    if (row.id != key) {
+      DIE("Lookup of %u found %" PRIu64 "\n", key, row.id);
+    }
+  }
+
+  bench_report("point_lookup", rows, &latencies);
+}
+
+static void bench_count_row(void* state, Row* row) {
+  (void)row;
+  (*(uint32_t*)state)++;
+}
+
+/**
+ * @brief Read every row in id order on one thread.
+ */
+static void bench_full_scan(Table* table, uint32_t rows) {
+  Latencies latencies;
+  ScanRange range = {.id_min = 0, .id_max = UINT64_MAX};
+
+  latencies_init(&latencies, BENCH_SCANS);
+
+  for (uint32_t i = 0; i < BENCH_SCANS; i++) {
+    uint32_t count = 0;
+
+    uint64_t start = bench_now();
+    scan_range(table, range, bench_count_row, &count);
+    latencies_add(&latencies, start);
+
+    if (count != rows) {
+      DIE("Scan saw %u of %u rows\n", count, rows);
+    }
+  }
+
+  bench_report("full_scan", rows, &latencies);
+}
+
+/**
+ * @brief Fetch random pages among a few resident ones, or, when sweep is set,
+ * every page in turn; a sweep over more pages than the pool holds evicts each
+ * page before it comes round again, so every fetch misses.
+ */
+static void bench_get_page(const char* name, Table* table, uint32_t rows,
+                           uint32_t num_pages, bool sweep) {
+  Latencies latencies;
+
+  latencies_init(&latencies, BENCH_OPS);
+
+  for (uint32_t i = 0; i < BENCH_OPS; i++) {
+    uint32_t page_num = sweep ? i % num_pages : bench_random(num_pages);
+
+    uint64_t start = bench_now();
+    get_page(table->pager, page_num);
+    latencies_add(&latencies, start);
+  }
+
+  bench_report(name, rows, &latencies);
+}
+
+static void bench_open_close(const char* filename, uint32_t rows) {
+  Latencies latencies;
+
+  latencies_init(&latencies, BENCH_OPENS);
+
+  for (uint32_t i = 0; i < BENCH_OPENS; i++) {
+    uint64_t start = bench_now();
+    db_close(bench_open(filename, PAGER_DEFAULT_FRAMES));
+    latencies_add(&latencies, start);
+  }
+
+  bench_report("db_open_close", rows, &latencies);
+}
+
+static void bench_size(const char* dir, uint32_t rows) {
+  char sequential[PATH_MAX];
+  char random[PATH_MAX];
+  uint32_t* ids = malloc(rows * sizeof(uint32_t));
+
+  snprintf(sequential, sizeof(sequential), "%s/sequential.db", dir);
+  snprintf(random, sizeof(random), "%s/random.db", dir);
+
+  for (uint32_t i = 0; i < rows; i++) {
+    ids[i] = i + 1;
+  }
+
+  bench_insert("insert_sequential", sequential, ids, rows);
+
+  for (uint32_t i = rows - 1; i > 0; i--) {
+    uint32_t j = bench_random(i + 1);
+    uint32_t id = ids[i];
+    ids[i] = ids[j];
+    ids[j] = id;
+  }
+
+  bench_insert("insert_random", random, ids, rows);
+  bench_remove(random);
+  free(ids);
+
+  Table* table = bench_open(sequential, PAGER_DEFAULT_FRAMES);
+  uint32_t num_pages = table->pager->num_pages;
+
+  bench_leaf_node_find(table, rows);
+  bench_point_lookup(table, rows);
+  bench_full_scan(table, rows);
+  bench_get_page("get_page_hit", table, rows, BENCH_HOT_PAGES, false);
+  db_close(table);
+
+  // a table that fits in the smallest pool cannot miss, so it is not timed
+  if (num_pages > PAGER_MIN_FRAMES) {
+    table = bench_open(sequential, PAGER_MIN_FRAMES);
+    bench_get_page("get_page_miss", table, rows, num_pages, true);
+    db_close(table);
+  }
+
+  bench_open_close(sequential, rows);
+  bench_remove(sequential);
+}
+
+int main(int argc, char* argv[]) {
+  char dir[] = "/tmp/pageboy-bench-XXXXXX";
+
+  if (!mkdtemp(dir)) {
+    DIE("%s\n", "Unable to create a directory for the benchmark databases");
+  }
+
+  printf("name\trows\tops\tops_per_sec\tp50_ns\tp99_ns\tp999_ns\n");
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      bench_size(dir, strtoul(argv[i], NULL, 10));
+    }
+  } else {
+    for (uint32_t i = 0;
+         i < sizeof(BENCH_DEFAULT_SIZES) / sizeof(BENCH_DEFAULT_SIZES[0]);
+         i++) {
+      bench_size(dir, BENCH_DEFAULT_SIZES[i]);
+    }
+  }
+
+  rmdir(dir);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "search.h"
+
+/*
+Check of the key_search kernels, run by `make search_check`. Every kernel the
+running CPU supports is compared with a plain linear lower bound on sorted key
+arrays of every size up to a few times SEARCH_LINEAR_KEYS, so that windows
+just under, at and over the linear width are finished by both the vector loop
+and its scalar tail. Keys straddle 2^63, since the vector kernels flip the
+sign bit to compare unsigned keys, and include 0, UINT64_MAX and runs of
+duplicates. Each array is searched for every key in it, its neighbours and
+the extremes of the key range.
+*/
+
+/**
+ * @brief Largest array checked; sizes step by one up to here.
+ */
+#define CHECK_MAX_KEYS (SEARCH_LINEAR_KEYS * 4 + 3)
+
+/**
+ * @brief Distinct key layouts checked at each size.
+ */
+#define CHECK_LAYOUTS 4
+
+static const uint64_t CHECK_EXTREMES[] = {
+    0, 1, 0x7fffffffffffffffu, 0x8000000000000000u, 0x8000000000000001u,
+    UINT64_MAX - 1, UINT64_MAX,
+};
+
+static uint32_t check_lower_bound(const uint64_t* keys, uint32_t num_keys,
+                                  uint64_t key) {
+  uint32_t i = 0;
+
+  while (i < num_keys && keys[i] < key) {
+    i++;
+  }
+
+  return i;
+}
+
+/**
+ * @brief Fill keys with num_keys sorted keys laid out one of
+ * CHECK_LAYOUTS ways.
+ */
+static void check_fill(uint64_t* keys, uint32_t num_keys, uint32_t layout) {
+  for (uint32_t i = 0; i < num_keys; i++) {
+    switch (layout) {
+      case 0:  // spaced and centred on 2^63, so half have the top bit set
+        keys[i] = 0x8000000000000000u - (uint64_t)num_keys * 2 + i * 4;
+        break;
+      case 1:  // every key has the top bit set, ending at UINT64_MAX
+        keys[i] = UINT64_MAX - (uint64_t)(num_keys - 1 - i) * 3;
+        break;
+      case 2:  // spread over the whole range, starting at 0
+        keys[i] = i * (UINT64_MAX / (num_keys ? num_keys : 1));
+        break;
+      default:  // small keys in runs of three duplicates
+        keys[i] = 1 + i / 3 * 2;
+        break;
+    }
+  }
+}
+
+static void check_key(const SearchKernelInfo* kernel, const uint64_t* keys,
+                      uint32_t num_keys, uint32_t layout, uint64_t key) {
+  uint32_t expected = check_lower_bound(keys, num_keys, key);
+  uint32_t found = kernel->search(keys, num_keys, key);
+
+  if (found != expected) {
+    DIE("%s: %u keys, layout %u, key %#" PRIx64 ": got %u, expected %u\n",
+        kernel->name, num_keys, layout, key, found, expected);
+  }
+}
+
+int main(void) {
+  SearchKernelInfo kernels[SEARCH_MAX_KERNELS];
+  uint32_t num_kernels = search_kernels(kernels);
+  uint64_t keys[CHECK_MAX_KEYS];
+  uint64_t searches = 0;
+
+  for (uint32_t k = 0; k < num_kernels; k++) {
+    for (uint32_t n = 0; n <= CHECK_MAX_KEYS; n++) {
+      for (uint32_t layout = 0; layout < CHECK_LAYOUTS; layout++) {
+        check_fill(keys, n, layout);
+
+        for (uint32_t i = 0; i < n; i++) {
+          check_key(&kernels[k], keys, n, layout, keys[i] - 1);
+          check_key(&kernels[k], keys, n, layout, keys[i]);
+          check_key(&kernels[k], keys, n, layout, keys[i] + 1);
+          searches += 3;
+        }
+
+        for (uint32_t i = 0;
+             i < sizeof(CHECK_EXTREMES) / sizeof(CHECK_EXTREMES[0]); i++) {
+          check_key(&kernels[k], keys, n, layout, CHECK_EXTREMES[i]);
+          searches++;
+        }
+      }
+    }
+
+    printf("%s\tok\n", kernels[k].name);
+  }
+
+  printf("%" PRIu64 " searches matched\n", searches);
+  return EXIT_SUCCESS;
+}
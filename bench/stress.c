@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btree.h"
+#include "common.h"
+#include "pager.h"
+
+/*
+Concurrency stress test for the storage engine, run by `make stress`. One
+writer inserts rows in random order, committing each, while reader threads
+check the table as it grows: most look up a row the writer has already
+published, through the key filter and then the tree, and the rest scan the
+whole table. Every row read must be intact and scans must return ids in
+increasing order, without missing any row published before they started.
+Readers latch pages and the table as statements do, so a small buffer pool
+makes them race evictions and splits. Each run is repeated in buffered and
+mmap mode for every reader count; build with -fsanitize=thread, as
+`make stress STRESS_CFLAGS=-fsanitize=thread` does, to check for data races
+as well. ThreadSanitizer may report a lock-order inversion in
+pager_latch_pinned: inserts couple latches from parent to child, and once a
+frame is reused for another page it can be latched in the opposite order to
+before. Frame latches always follow the tree top-down at any one time, so
+the report is spurious; TSAN_OPTIONS=detect_deadlocks=0 hides it.
+*/
+
+/**
+ * @brief Rows inserted by each run when no count is given.
+ */
+#define STRESS_DEFAULT_ROWS 20000
+
+/**
+ * @brief Reader threads for each run, up to the most run at once.
+ */
+static const uint32_t STRESS_READERS[] = {1, 2, 4, 8};
+#define STRESS_MAX_READERS 8
+
+/**
+ * @brief Buffer pool frames; few enough that pages are evicted while readers
+ * hold others.
+ */
+#define STRESS_FRAMES 64
+
+/**
+ * @brief One lookup in this many is a full scan instead.
+ */
+#define STRESS_SCAN_EVERY 8
+
+typedef struct {
+  Table* table;
+  uint64_t* ids;  // in the order the writer inserts them
+  uint32_t num_rows;
+  _Atomic uint32_t published;  // rows inserted and committed so far
+  _Atomic bool done;
+} Stress;
+
+typedef struct {
+  Stress* stress;
+  uint32_t seed;
+  uint64_t scans;
+  uint64_t lookups;
+} Reader;
+
+static void stress_row(uint64_t id, Row* row) {
+  row->id = id;
+  snprintf(row->username, sizeof(row->username), "u%" PRIu64, id);
+  // emails of many lengths, so that leaves split at varying cell counts
+  snprintf(row->email, sizeof(row->email), "e%" PRIu64 "-%0*d", id,
+           (int)(id % 200), 0);
+}
+
+/**
+ * @brief Check the row under the cursor against the one its id was built
+ * from, and that it follows the id of the row before it, if any.
+ */
+static uint64_t stress_check_row(Cursor* cursor, uint64_t prev, bool first) {
+  Row row;
+  Row expected;
+
+  deserialize_row(cursor_value(cursor), &row);
+  stress_row(row.id, &expected);
+
+  if (strcmp(row.username, expected.username) != 0 ||
+      strcmp(row.email, expected.email) != 0) {
+    DIE("Row %" PRIu64 " is corrupt\n", row.id);
+  }
+
+  if (!first && row.id <= prev) {
+    DIE("Scan returned %" PRIu64 " after %" PRIu64 "\n", row.id, prev);
+  }
+
+  return row.id;
+}
+
+static void* stress_write(void* arg) {
+  Stress* stress = arg;
+  Row row;
+
+  for (uint32_t i = 0; i < stress->num_rows; i++) {
+    stress_row(stress->ids[i], &row);
+
+    if (!table_insert(stress->table, &row)) {
+      DIE("Insert of %" PRIu64 " found a duplicate\n", row.id);
+    }
+
+    pager_commit(stress->table->pager);
+    atomic_store_explicit(&stress->published, i + 1, memory_order_release);
+  }
+
+  atomic_store_explicit(&stress->done, true, memory_order_release);
+  return NULL;
+}
+
+static void stress_scan(Stress* stress) {
+  uint32_t before =
+      atomic_load_explicit(&stress->published, memory_order_acquire);
+  uint32_t count = 0;
+  uint64_t prev = 0;
+  Cursor cursor;
+
+  table_scan(stress->table, 0, &cursor);
+
+  while (!(cursor.end)) {
+    prev = stress_check_row(&cursor, prev, count == 0);
+    count++;
+    cursor_advance(&cursor);
+  }
+
+  cursor_close(&cursor);
+
+  if (count < before) {
+    DIE("Scan saw %u rows, fewer than the %u published\n", count, before);
+  }
+}
+
+static void stress_lookup(Stress* stress, uint64_t id) {
+  Cursor cursor;
+
+  if (!table_may_contain(stress->table, id)) {
+    DIE("Key filter missed %" PRIu64 "\n", id);
+  }
+
+  table_scan(stress->table, id, &cursor);
+
+  if (cursor.end) {
+    DIE("Lookup of %" PRIu64 " found nothing\n", id);
+  }
+
+  uint64_t found = stress_check_row(&cursor, 0, true);
+  cursor_close(&cursor);
+
+  if (found != id) {
+    DIE("Lookup of %" PRIu64 " found %" PRIu64 "\n", id, found);
+  }
+}
+
+static void* stress_read(void* arg) {
+  Reader* reader = arg;
+  Stress* stress = reader->stress;
+
+  while (!atomic_load_explicit(&stress->done, memory_order_acquire)) {
+    if (rand_r(&reader->seed) % STRESS_SCAN_EVERY == 0) {
+      stress_scan(stress);
+      reader->scans++;
+      continue;
+    }
+
+    uint32_t published =
+        atomic_load_explicit(&stress->published, memory_order_acquire);
+    if (published == 0) {
+      continue;
+    }
+
+    stress_lookup(stress, stress->ids[rand_r(&reader->seed) % published]);
+    reader->lookups++;
+  }
+
+  return NULL;
+}
+
+static void stress_remove(const char* filename) {
+  char wal[PATH_MAX + 8];
+
+  snprintf(wal, sizeof(wal), "%s-wal", filename);
+  unlink(filename);
+  unlink(wal);
+}
+
+/**
+ * @brief Insert num_rows rows into a fresh database while num_readers threads
+ * read it, then check that every row arrived.
+ */
+static void stress_run(const char* dir, uint32_t num_rows,
+                       uint32_t num_readers, PagerMode mode) {
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s/stress.db", dir);
+  stress_remove(filename);
+
+  PagerOptions options = {
+      .mode = mode,
+      .num_frames = STRESS_FRAMES,
+      .wal = mode == PAGER_MODE_BUFFERED,
+  };
+  Stress stress = {
+      .table = db_open(filename, &options),
+      .ids = malloc(num_rows * sizeof(uint64_t)),
+      .num_rows = num_rows,
+  };
+  atomic_init(&stress.published, 0);
+  atomic_init(&stress.done, false);
+
+  // spaced ids, shuffled the same way on every run, land all over the tree
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < num_rows; i++) {
+    stress.ids[i] = (uint64_t)i * 3 + 1;
+  }
+  for (uint32_t i = num_rows - 1; i > 0; i--) {
+    uint32_t j = rand_r(&seed) % (i + 1);
+    uint64_t id = stress.ids[i];
+    stress.ids[i] = stress.ids[j];
+    stress.ids[j] = id;
+  }
+
+  Reader readers[STRESS_MAX_READERS];
+  pthread_t threads[STRESS_MAX_READERS];
+  pthread_t writer;
+
+  for (uint32_t i = 0; i < num_readers; i++) {
+    readers[i] = (Reader){.stress = &stress, .seed = i * 7919 + 1};
+    pthread_create(&threads[i], NULL, stress_read, &readers[i]);
+  }
+
+  pthread_create(&writer, NULL, stress_write, &stress);
+  pthread_join(writer, NULL);
+
+  uint64_t scans = 0;
+  uint64_t lookups = 0;
+
+  for (uint32_t i = 0; i < num_readers; i++) {
+    pthread_join(threads[i], NULL);
+    scans += readers[i].scans;
+    lookups += readers[i].lookups;
+  }
+
+  stress_scan(&stress);
+
+  printf("%s\t%u\t%u\t%" PRIu64 "\t%" PRIu64 "\n",
+         mode == PAGER_MODE_MMAP ? "mmap" : "buffered", num_rows,
+         num_readers, scans, lookups);
+
+  db_close(stress.table);
+  free(stress.ids);
+  stress_remove(filename);
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t num_rows =
+      argc > 1 ? strtoul(argv[1], NULL, 10) : STRESS_DEFAULT_ROWS;
+  char dir[] = "/tmp/pageboy-stress-XXXXXX";
+
+  if (num_rows == 0) {
+    DIE("%s\n", "Usage: stress [rows]");
+  }
+
+  if (!mkdtemp(dir)) {
+    DIE("%s\n", "Unable to create a directory for the stress databases");
+  }
+
+  printf("mode\trows\treaders\tscans\tlookups\n");
+
+  for (uint32_t i = 0;
+       i < sizeof(STRESS_READERS) / sizeof(STRESS_READERS[0]); i++) {
+    stress_run(dir, num_rows, STRESS_READERS[i], PAGER_MODE_BUFFERED);
+    stress_run(dir, num_rows, STRESS_READERS[i], PAGER_MODE_MMAP);
+  }
+
+  rmdir(dir);
+  return EXIT_SUCCESS;
+}
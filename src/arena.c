@@ -0,0 +1,112 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+static const size_t ARENA_ALIGN = alignof(max_align_t);
+
+struct ArenaBlock {
+  ArenaBlock* next;
+  size_t size;  // bytes in data
+  max_align_t data[];
+};
+
+static ArenaBlock* arena_block_new(size_t size) {
+  ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+  if (!block) {
+    DIE("Unable to allocate %zu bytes of scratch memory\n", size);
+  }
+
+  block->next = NULL;
+  block->size = size;
+  return block;
+}
+
+/**
+ * @brief Return size bytes, aligned for any type, that stay valid until the
+ * arena is reset.
+ */
+void* arena_alloc(Arena* arena, size_t size) {
+  ArenaBlock* block = arena->current;
+
+  size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+  if (!block || arena->used + size > block->size) {
+    size_t block_size = block ? block->size * 2 : ARENA_BLOCK_SIZE;
+    if (block_size < size) {
+      block_size = size;
+    }
+
+    ArenaBlock* next = arena_block_new(block_size);
+    if (block) {
+      block->next = next;
+    } else {
+      arena->head = next;
+    }
+
+    arena->current = block = next;
+    arena->used = 0;
+  }
+
+  void* ptr = (char*)block->data + arena->used;
+  arena->used += size;
+  return ptr;
+}
+
+/**
+ * @brief Enlarge the latest allocation in place when it is last in its block,
+ * or else copy it somewhere bigger; the old copy is wasted until the reset.
+ */
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size) {
+  size_t old_aligned = (old_size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  size_t new_aligned = (new_size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  ArenaBlock* block = arena->current;
+
+  if (block && (char*)ptr + old_aligned == (char*)block->data + arena->used &&
+      arena->used - old_aligned + new_aligned <= block->size) {
+    arena->used += new_aligned - old_aligned;
+    return ptr;
+  }
+
+  void* grown = arena_alloc(arena, new_size);
+  memcpy(grown, ptr, old_size);
+  return grown;
+}
+
+/**
+ * @brief Give back everything allocated. If the last round needed more than
+ * one block, they are replaced by one block as big as all of them.
+ */
+void arena_reset(Arena* arena) {
+  if (arena->head && arena->head->next) {
+    size_t total = 0;
+
+    for (ArenaBlock* block = arena->head; block;) {
+      ArenaBlock* next = block->next;
+      total += block->size;
+      free(block);
+      block = next;
+    }
+
+    arena->head = arena_block_new(total);
+  }
+
+  arena->current = arena->head;
+  arena->used = 0;
+}
+
+void arena_destroy(Arena* arena) {
+  for (ArenaBlock* block = arena->head; block;) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+
+  arena->head = NULL;
+  arena->current = NULL;
+  arena->used = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Size of the first block an arena takes from the heap; each block
+ * after that is at least twice the size of the one before.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+/**
+ * @brief Scratch memory that lives until the next arena_reset. Allocations
+ * bump an offset through the current block, and a reset gives back everything
+ * at once while keeping the memory, merged into a single block, for next
+ * time. Once an arena has grown to what a statement needs, statements stop
+ * calling malloc. A zeroed arena is empty and ready to use. An arena belongs
+ * to one thread at a time.
+ */
+typedef struct {
+  ArenaBlock* head;
+  ArenaBlock* current;  // the last block, which allocations come from
+  size_t used;          // bytes of current handed out
+} Arena;
+
+void* arena_alloc(Arena* arena, size_t size);
+
+void* arena_grow(Arena* arena, void* ptr, size_t old_size, size_t new_size);
+
+void arena_reset(Arena* arena);
+
+void arena_destroy(Arena* arena);
+
+#endif /* ARENA_H */
@@ -1,8 +1,28 @@
 #include "btree.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
+#include "index.h"
+#include "search.h"
+
+/**
+ * @brief Return the bytes a leaf has for its slots and cells: all of the page
+ * past the header.
+ */
+uint32_t leaf_node_space_for_cells(Pager* pager) {
+  return pager->page_size - LEAF_NODE_HEADER_SIZE;
+}
+
+/**
+ * @brief Return the most keys an internal node can hold, one fewer than its
+ * children.
+ */
+uint32_t internal_node_max_cells(Pager* pager) {
+  return (pager->page_size - INTERNAL_NODE_HEADER_SIZE) /
+         INTERNAL_NODE_CELL_SIZE;
+}
 
 uint32_t* internal_node_num_keys(void* node) {
   return node + INTERNAL_NODE_NUM_KEYS_OFFSET;
@@ -18,11 +38,16 @@ uint32_t* internal_node_right_child(void* node) {
   return node + INTERNAL_NODE_RIGHT_CHILD_OFFSET;
 }
 
-uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
-  return node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE;
+static uint64_t* internal_node_keys(void* node) {
+  return node + INTERNAL_NODE_KEYS_OFFSET;
+}
+
+static uint32_t* internal_node_children(Pager* pager, void* node) {
+  return node + INTERNAL_NODE_KEYS_OFFSET +
+         internal_node_max_cells(pager) * INTERNAL_NODE_KEY_SIZE;
 }
 
-uint32_t* internal_node_child(void* node, uint32_t child_num) {
+uint32_t* internal_node_child(Pager* pager, void* node, uint32_t child_num) {
   uint32_t num_keys = *internal_node_num_keys(node);
   if (child_num > num_keys) {
     DIE("attempt to access child_num %d > num_keys %d\n", child_num, num_keys);
@@ -32,55 +57,73 @@ uint32_t* internal_node_child(void* node, uint32_t child_num) {
     return internal_node_right_child(node);
   }
 
-  return internal_node_cell(node, child_num);
+  return internal_node_children(pager, node) + child_num;
 }
 
-uint32_t* internal_node_key(void* node, uint32_t key_num) {
-  return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+uint64_t* internal_node_key(void* node, uint32_t key_num) {
+  return internal_node_keys(node) + key_num;
 }
 
-void internal_node_update_key(void* node, uint32_t old_key, uint32_t new_key) {
+void internal_node_update_key(void* node, uint64_t old_key, uint64_t new_key) {
   uint32_t old_child_idx = internal_node_find_child(node, old_key);
 
-  *internal_node_key(node, old_child_idx) = new_key;
+  // The right child has no key of its own; its max is implied
+  if (old_child_idx < *internal_node_num_keys(node)) {
+    *internal_node_key(node, old_child_idx) = new_key;
+  }
 }
 
 /**
- * @brief Return the  f the child which should contain the given key.
+ * @brief Return the index of the child which should contain the given key.
  */
-Cursor* internal_node_find_child(void* node, uint32_t key) {
-  uint32_t num_keys = *internal_node_num_keys(node);
-
-  // Binary search
-  uint32_t min_idx = 0;
-  uint32_t max_idx = num_keys;
-
-  while (min_idx != max_idx) {
-    uint32_t idx = (min_idx + max_idx) / 2;
-    uint32_t key_to_right = *internal_node_key(node, idx);
+uint32_t internal_node_find_child(void* node, uint64_t key) {
+  // the first child whose key to the right is >= key, else the right child
+  return key_search(internal_node_keys(node), *internal_node_num_keys(node),
+                    key);
+}
 
-    if (key_to_right >= key) {
-      max_idx = idx;
-    } else {
-      min_idx = idx + 1;
-    }
+/**
+ * @brief Latch a node on the way down to a leaf that is wanted in leaf_mode.
+ * Internal nodes are only read, so they are latched shared. A node's type only
+ * changes with the table latched exclusively, so it can be checked on the
+ * pinned page before choosing the latch.
+ */
+void* node_latch(Pager* pager, uint32_t page_num, LatchMode leaf_mode) {
+  if (leaf_mode == LATCH_NONE) {
+    return get_page(pager, page_num);
   }
 
-  return min_idx;
+  void* node = pager_pin(pager, page_num);
+  pager_latch_pinned(pager, node,
+                     get_node_type(node) == NODE_LEAF ? leaf_mode
+                                                      : LATCH_SHARED);
+  return node;
 }
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-  void* node = get_page(table->pager, page_num);
-
+/**
+ * @brief Descend from an internal node the caller has latched (see
+ * node_latch), coupling latches: the child is latched before the node is
+ * released.
+ */
+void internal_node_find(Table* table, void* node, uint64_t key,
+                        LatchMode mode, Cursor* cursor) {
   uint32_t child_idx = internal_node_find_child(node, key);
-  uint32_t child_num = *internal_node_child(node, child_idx);
-  void* child = get_page(table->pager, child_num);
+  uint32_t child_num = *internal_node_child(table->pager, node, child_idx);
+  void* child = node_latch(table->pager, child_num, mode);
+
+  pager_unlatch(table->pager, node,
+                mode == LATCH_NONE ? LATCH_NONE : LATCH_SHARED);
 
   switch (get_node_type(child)) {
     case NODE_LEAF:
-      return leaf_node_find(table, child_num, key);
+      leaf_node_find(table, child_num, child, key, cursor);
+      return;
     case NODE_INTERNAL:
-      return internal_node_find(table, child_num, key);
+      internal_node_find(table, child, key, mode, cursor);
+      return;
+    case NODE_INDEX_INTERNAL:
+    case NODE_INDEX_LEAF:
+      break;
   }
 
   DIE("%s\n", "todo");
@@ -92,42 +135,180 @@ void internal_node_insert(Table* table, uint32_t parent_page_num,
   void* parent = get_page(table->pager, parent_page_num);
   void* child = get_page(table->pager, child_page_num);
 
-  uint32_t child_max_key = get_node_max_key(child);
+  uint64_t child_max_key = get_node_max_key(table->pager, child);
   uint32_t idx = internal_node_find_child(parent, child_max_key);
   uint32_t original_num_keys = *internal_node_num_keys(parent);
 
-  *internal_node_num_keys(parent) = original_num_keys + 1;
-
-  if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-    DIE("%s\n", "TODO");
+  if (original_num_keys >= internal_node_max_cells(table->pager)) {
+    internal_node_split_and_insert(table, parent_page_num, child_page_num);
+    return;
   }
 
+  *internal_node_num_keys(parent) = original_num_keys + 1;
+  pager_mark_dirty(table->pager, parent_page_num);
+
   uint32_t right_child_page_num = *internal_node_right_child(parent);
   void* right_child = get_page(table->pager, right_child_page_num);
+  uint64_t right_child_max_key = get_node_max_key(table->pager, right_child);
 
-  if (child_max_key > get_node_max_key(right_child)) {
+  if (child_max_key > right_child_max_key) {
     // Replace right child
-    *internal_node_child(parent, original_num_keys) = right_child_page_num;
-    *internal_node_key(parent, original_num_keys) =
-        get_node_max_key(right_child);
+    *internal_node_child(table->pager, parent, original_num_keys) =
+        right_child_page_num;
+    *internal_node_key(parent, original_num_keys) = right_child_max_key;
     *internal_node_right_child(parent) = child_page_num;
   } else {
     // Allocate space for new cell
-    for (uint32_t i = original_num_keys; i > idx; i--) {
-      void* destination = internal_node_cell(parent, i);
-      void* source = internal_node_cell(parent, i - 1);
-      memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+    uint32_t count = original_num_keys - idx;
+    memmove(internal_node_keys(parent) + idx + 1,
+            internal_node_keys(parent) + idx, count * INTERNAL_NODE_KEY_SIZE);
+    uint32_t* children = internal_node_children(table->pager, parent);
+    memmove(children + idx + 1, children + idx,
+            count * INTERNAL_NODE_CHILD_SIZE);
+
+    *internal_node_child(table->pager, parent, idx) = child_page_num;
+    *internal_node_key(parent, idx) = child_max_key;
+  }
+}
+
+/**
+ * @brief Fill an internal node from parallel arrays of n children and their
+ * max keys. The last child becomes the right child; its key is implied.
+ */
+void internal_node_fill(Pager* pager, void* node, uint32_t* children,
+                        uint64_t* keys, uint32_t n) {
+  *internal_node_num_keys(node) = n - 1;
+
+  memcpy(internal_node_children(pager, node), children,
+         (n - 1) * INTERNAL_NODE_CHILD_SIZE);
+  memcpy(internal_node_keys(node), keys, (n - 1) * INTERNAL_NODE_KEY_SIZE);
+
+  *internal_node_right_child(node) = children[n - 1];
+}
+
+/**
+ * @brief Whether a node lies on the right edge of the tree, as the right child
+ * of every node above it.
+ */
+static bool node_is_rightmost(Pager* pager, uint32_t page_num) {
+  void* node = get_page(pager, page_num);
+
+  while (!is_root_node(node)) {
+    uint32_t parent_page_num = *get_parent_node(node);
+
+    if (*internal_node_right_child(get_page(pager, parent_page_num)) !=
+        page_num) {
+      return false;
     }
 
-    *internal_node_child(parent, idx) = child_page_num;
-    *internal_node_key(parent, idx) = child_max_key;
+    page_num = parent_page_num;
+    node = get_page(pager, page_num);
+  }
+
+  return true;
+}
+
+/*
+Split a full internal node. The extant children plus the new one are divided
+across the old (left) node and a new (right) sibling, and the sibling is then
+inserted into the parent - which may itself split, propagating up the tree
+until a parent has room or the root splits and the tree grows by one level.
+A new child past the end of the tree's right edge is taken for an append, and
+the old node is left nearly full, as leaves are.
+*/
+void internal_node_split_and_insert(Table* table, uint32_t old_page_num,
+                                    uint32_t child_page_num) {
+  Pager* pager = table->pager;
+  uint32_t max_cells = internal_node_max_cells(pager);
+  uint32_t children[max_cells + 2];
+  uint64_t keys[max_cells + 2];
+
+  atomic_fetch_add_explicit(&table->stats.internal_splits, 1,
+                            memory_order_relaxed);
+
+  uint64_t child_max_key =
+      get_node_max_key(pager, get_page(pager, child_page_num));
+  uint64_t old_max = get_node_max_key(pager, get_page(pager, old_page_num));
+  bool rightmost = node_is_rightmost(pager, old_page_num);
+
+  // Gather every child in key order, placing the new child among them.
+  void* old_node = get_page(pager, old_page_num);
+  uint32_t num_keys = *internal_node_num_keys(old_node);
+  uint32_t count = 0;
+  bool placed = false;
+
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint64_t key = i < num_keys ? *internal_node_key(old_node, i) : old_max;
+
+    if (!placed && child_max_key < key) {
+      children[count] = child_page_num;
+      keys[count++] = child_max_key;
+      placed = true;
+    }
+
+    children[count] = *internal_node_child(pager, old_node, i);
+    keys[count++] = key;
+  }
+
+  if (!placed) {
+    children[count] = child_page_num;
+    keys[count++] = child_max_key;
+  }
+
+  // The max_cells + 2 children (all extant keys, the right child, and the new
+  // one) are divided evenly, except that an append to the right edge of the
+  // tree leaves all but two on the left, since nothing more will arrive there
+  uint32_t left_count =
+      rightmost && !placed ? max_cells : (max_cells + 2) - (max_cells + 2) / 2;
+
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  internal_node_init(new_node);
+  *get_parent_node(new_node) = *get_parent_node(old_node);
+
+  internal_node_fill(pager, old_node, children, keys, left_count);
+  internal_node_fill(pager, new_node, children + left_count,
+                     keys + left_count, count - left_count);
+
+  pager_mark_dirty(pager, old_page_num);
+  pager_mark_dirty(pager, new_page_num);
+
+  // Point every child at its (possibly new) parent. Fetching the children
+  // may evict the nodes above, so they are re-fetched afterward.
+  void* child = get_page(pager, child_page_num);
+  *get_parent_node(child) = old_page_num;
+  pager_mark_dirty(pager, child_page_num);
+
+  for (uint32_t i = left_count; i < count; i++) {
+    child = get_page(pager, children[i]);
+    *get_parent_node(child) = new_page_num;
+    pager_mark_dirty(pager, children[i]);
+  }
+
+  old_node = get_page(pager, old_page_num);
+
+  if (is_root_node(old_node)) {
+    set_new_root(table, new_page_num);
+    return;
   }
+
+  uint32_t parent_page_num = *get_parent_node(old_node);
+  void* parent = get_page(pager, parent_page_num);
+
+  internal_node_update_key(parent, old_max, keys[left_count - 1]);
+  pager_mark_dirty(pager, parent_page_num);
+  internal_node_insert(table, parent_page_num, new_page_num);
 }
 
-uint32_t get_node_max_key(void* node) {
+/**
+ * @brief Return the largest key stored in the subtree rooted at node.
+ * For an internal node that is the max of its right-most descendant.
+ */
+uint64_t get_node_max_key(Pager* pager, void* node) {
   switch (get_node_type(node)) {
     case NODE_INTERNAL:
-      return *internal_node_key(node, *internal_node_num_keys(node) - 1);
+      return get_node_max_key(
+          pager, get_page(pager, *internal_node_right_child(node)));
 
     case NODE_LEAF:
       return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
@@ -164,106 +345,388 @@ void set_new_root(Table* table, uint32_t right_child_page_num) {
   void* left_child = get_page(table->pager, left_child_page_num);
 
   // Copy old root to left child
-  memcpy(left_child, root, PAGE_SIZE);
+  memcpy(left_child, root, table->pager->page_size);
   set_root_node(left_child, false);
+  *get_next_index(left_child) = 0;
 
   // Initialize root page as new internal node w/ 1 key, 2 children
   internal_node_init(root);
+  set_root_node(root, true);
   *internal_node_num_keys(root) = 1;
-  *internal_node_child(root, 0) = left_child_page_num;
+  *internal_node_child(table->pager, root, 0) = left_child_page_num;
 
-  uint32_t left_child_max_key = get_node_max_key(left_child);
+  uint64_t left_child_max_key = get_node_max_key(table->pager, left_child);
   *internal_node_key(root, 0) = left_child_max_key;
   *internal_node_right_child(root) = right_child_page_num;
 
   *get_parent_node(left_child) = table->root_page_num;
   *get_parent_node(right_child) = table->root_page_num;
+
+  pager_mark_dirty(table->pager, table->root_page_num);
+  pager_mark_dirty(table->pager, left_child_page_num);
+  pager_mark_dirty(table->pager, right_child_page_num);
+
+  // An internal left child's children still point at the root page
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(left_child);
+
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      left_child = get_page(table->pager, left_child_page_num);
+      uint32_t grandchild_page_num =
+          *internal_node_child(table->pager, left_child, i);
+
+      void* grandchild = get_page(table->pager, grandchild_page_num);
+      *get_parent_node(grandchild) = left_child_page_num;
+      pager_mark_dirty(table->pager, grandchild_page_num);
+    }
+  }
 }
 
 uint32_t* leaf_node_num_cells(void* node) {
   return node + LEAF_NODE_NUM_CELLS_OFFSET;
 }
 
-void* leaf_node_cell(void* node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+static uint32_t* leaf_node_content_start(void* node) {
+  return node + LEAF_NODE_CONTENT_START_OFFSET;
+}
+
+static uint32_t* leaf_node_free_bytes_ptr(void* node) {
+  return node + LEAF_NODE_FREE_BYTES_OFFSET;
+}
+
+uint64_t* leaf_node_keys(void* node) {
+  return node + LEAF_NODE_KEYS_OFFSET;
+}
+
+// The offsets follow the keys, so they move whenever num_cells changes
+static uint32_t* leaf_node_cell_offsets(void* node) {
+  return (uint32_t*)(leaf_node_keys(node) + *leaf_node_num_cells(node));
 }
 
-uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+static uint32_t* leaf_node_cell_offset(void* node, uint32_t cell_num) {
+  return leaf_node_cell_offsets(node) + cell_num;
+}
+
+uint64_t* leaf_node_key(void* node, uint32_t cell_num) {
+  return leaf_node_keys(node) + cell_num;
 }
 
 void* leaf_node_value(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+  return node + *leaf_node_cell_offset(node, cell_num);
 }
 
-void leaf_node_init(void* node) {
+/**
+ * @brief Return the bytes still free in a leaf, counting holes as well as the
+ * gap between the slot directory and the cells.
+ */
+uint32_t leaf_node_free_bytes(void* node) {
+  return *leaf_node_free_bytes_ptr(node);
+}
+
+bool leaf_node_fits(void* node, Row* value) {
+  return leaf_node_free_bytes(node) >= LEAF_NODE_SLOT_SIZE + row_size(value);
+}
+
+void leaf_node_init(Pager* pager, void* node) {
   set_node_type(node, NODE_LEAF);
   set_root_node(node, false);
   *leaf_node_num_cells(node) = 0;
   *leaf_node_next_leaf(node) = 0;  // where 0 represents no sibling
+  *leaf_node_content_start(node) = pager->page_size;
+  *leaf_node_free_bytes_ptr(node) = leaf_node_space_for_cells(pager);
 }
 
 uint32_t* leaf_node_next_leaf(void* node) {
   return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
 
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
+/**
+ * @brief Repack the cells against the end of the page so every hole left
+ * between them joins the free gap.
+ */
+void leaf_node_compact(Pager* pager, void* node) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  // copies of pages live on the stack, in words to keep the headers aligned
+  uint64_t copy_words[pager->page_size / sizeof(uint64_t)];
+  void* copy = copy_words;
+  memcpy(copy, node, pager->page_size);
+
+  uint32_t content_start = pager->page_size;
+
+  for (uint32_t i = 0; i < num_cells; i++) {
+    void* cell = leaf_node_value(copy, i);
+    uint32_t size = serialized_row_size(cell);
+
+    content_start -= size;
+    memcpy(node + content_start, cell, size);
+    *leaf_node_cell_offset(node, i) = content_start;
+  }
+
+  *leaf_node_content_start(node) = content_start;
+}
 
+/**
+ * @brief Open a slot at cell_num for a cell of the given size and return
+ * where the cell's bytes go. The caller has checked that it fits.
+ */
+static void* leaf_node_alloc_cell(Pager* pager, void* node, uint32_t cell_num,
+                                  uint64_t key, uint32_t size) {
   uint32_t num_cells = *leaf_node_num_cells(node);
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
+  uint32_t slots_end =
+      LEAF_NODE_HEADER_SIZE + (num_cells + 1) * LEAF_NODE_SLOT_SIZE;
+
+  if (*leaf_node_content_start(node) < slots_end + size) {
+    leaf_node_compact(pager, node);
+  }
+
+  // Growing the key array by one pushes every offset back a key's width, and
+  // those after cell_num one place more
+  uint64_t* keys = leaf_node_keys(node);
+  uint32_t* offsets = (uint32_t*)(keys + num_cells);
+  uint32_t* new_offsets = (uint32_t*)(keys + num_cells + 1);
+
+  memmove(new_offsets + cell_num + 1, offsets + cell_num,
+          (num_cells - cell_num) * LEAF_NODE_CELL_OFFSET_SIZE);
+  memmove(new_offsets, offsets, cell_num * LEAF_NODE_CELL_OFFSET_SIZE);
+  memmove(keys + cell_num + 1, keys + cell_num,
+          (num_cells - cell_num) * LEAF_NODE_KEY_SIZE);
+
+  *leaf_node_content_start(node) -= size;
+  *leaf_node_free_bytes_ptr(node) -= LEAF_NODE_SLOT_SIZE + size;
+  *leaf_node_num_cells(node) = num_cells + 1;
+
+  *leaf_node_key(node, cell_num) = key;
+  *leaf_node_cell_offset(node, cell_num) = *leaf_node_content_start(node);
+
+  return node + *leaf_node_content_start(node);
+}
+
+/**
+ * @brief Store value as cell cell_num of a leaf with room for it, shifting
+ * later slots right. Nothing is marked dirty.
+ */
+void leaf_node_put(Pager* pager, void* node, uint32_t cell_num, uint64_t key,
+                   Row* value) {
+  serialize_row(value, leaf_node_alloc_cell(pager, node, cell_num, key,
+                                            row_size(value)));
+}
+
+// slots after cell_num each move one place right to make room for a new cell
+static void table_count_shift(Table* table, void* node, uint32_t cell_num) {
+  atomic_fetch_add_explicit(&table->stats.cells_shifted,
+                            *leaf_node_num_cells(node) - cell_num,
+                            memory_order_relaxed);
+}
+
+/**
+ * @brief Insert a row at the cursor, splitting the leaf if it is full, and
+ * file it in the table's key filter and indexes.
+ */
+void leaf_node_insert(Cursor* cursor, uint64_t key, Row* value) {
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+
+  filter_add(&cursor->table->filter, key);
+
+  if (!leaf_node_fits(node, value)) {
     // node full
     leaf_node_split_and_insert(cursor, key, value);
-    return;
+  } else {
+    table_count_shift(cursor->table, node, cursor->cell_num);
+    leaf_node_put(cursor->table->pager, node, cursor->cell_num, key, value);
+    pager_mark_dirty(cursor->table->pager, cursor->page_num);
+  }
+
+  atomic_fetch_add_explicit(&cursor->table->pager->num_rows, 1,
+                            memory_order_relaxed);
+
+  index_insert_row(cursor->table, value);
+}
+
+/**
+ * @brief Rebuild the table's key filter from the keys in its leaves, sized
+ * for the row count the pager keeps. Rows are never read. The caller holds
+ * the table latched exclusively, or has it to itself.
+ */
+void table_build_filter(Table* table) {
+  Pager* pager = table->pager;
+  uint32_t page_num = table->root_page_num;
+  void* node = get_page(pager, page_num);
+
+  filter_destroy(&table->filter);
+  filter_init(&table->filter,
+              atomic_load_explicit(&pager->num_rows, memory_order_relaxed));
+
+  while (get_node_type(node) == NODE_INTERNAL) {
+    page_num = *internal_node_child(pager, node, 0);
+    node = get_page(pager, page_num);
+  }
+
+  while (1) {
+    filter_add_all(&table->filter, leaf_node_keys(node),
+                   *leaf_node_num_cells(node));
+
+    page_num = *leaf_node_next_leaf(node);
+    if (page_num == 0) {
+      break;
+    }
+
+    node = get_page(pager, page_num);
   }
+}
 
-  if (cursor->cell_num < num_cells) {
-    // allocate room for new cell
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
+/**
+ * @brief Whether a row with the given id may be in the table; false means it
+ * certainly is not, without a look at the tree.
+ */
+bool table_may_contain(Table* table, uint64_t id) {
+  table_lock(table, LATCH_SHARED);
+  bool found = filter_may_contain(&table->filter, id);
+  table_unlock(table);
+
+  return found;
+}
+
+/*
+Ids mostly arrive in increasing order, so most inserts land past the last key
+of the rightmost leaf. Descents remember which leaf that is, and an insert of a
+larger key goes straight to it. The page may since have been freed and reused,
+so it is trusted only while it is still a table leaf with no next leaf: there
+is one such leaf, and no descent would find another. Reading it is safe while
+the table is latched, as nothing can restructure the tree.
+*/
+static bool table_find_append(Table* table, uint64_t key, LatchMode mode,
+                              Cursor* cursor) {
+  uint32_t page_num =
+      atomic_load_explicit(&table->last_leaf, memory_order_relaxed);
+  void* node = pager_latch(table->pager, page_num, mode);
+
+  if (get_node_type(node) == NODE_LEAF && *leaf_node_next_leaf(node) == 0) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    if (is_root_node(node) ||
+        (num_cells > 0 && key > *leaf_node_key(node, num_cells - 1))) {
+      leaf_node_find(table, page_num, node, key, cursor);
+      cursor->latch = mode;
+      return true;
     }
   }
 
-  *(leaf_node_num_cells(node)) += 1;
-  *(leaf_node_key(node, cursor->cell_num)) = key;
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+  pager_unlatch(table->pager, node, mode);
+  return false;
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-  void* node = get_page(table->pager, page_num);
+/**
+ * @brief Insert a row unless its id is already present, returning whether it
+ * was. Optimistically only the leaf is latched exclusively, alongside other
+ * readers and writers; if the row does not fit, the split may propagate up
+ * the tree, so the insert starts over with the whole table latched. A table
+ * with indexes always takes the latched path.
+ */
+bool table_insert(Table* table, Row* row) {
+  Pager* pager = table->pager;
+
+  if (pager->mode == PAGER_MODE_BUFFERED) {
+    table_lock(table, LATCH_SHARED);
+
+    // indexes are only changed with the table latched exclusively
+    if (table_has_indexes(table)) {
+      table_unlock(table);
+    } else {
+      Cursor cursor;
+      if (!table_find_append(table, row->id, LATCH_EXCLUSIVE, &cursor)) {
+        table_find(table, row->id, LATCH_EXCLUSIVE, &cursor);
+      }
+
+      void* node = cursor.node;
+      uint32_t num_cells = *leaf_node_num_cells(node);
+
+      bool duplicate = cursor.cell_num < num_cells &&
+                       *leaf_node_key(node, cursor.cell_num) == row->id;
+      bool fits = leaf_node_fits(node, row);
+
+      if (!duplicate && fits) {
+        filter_add(&table->filter, row->id);
+        table_count_shift(table, node, cursor.cell_num);
+        leaf_node_put(pager, node, cursor.cell_num, row->id, row);
+        pager_mark_dirty(pager, cursor.page_num);
+        atomic_fetch_add_explicit(&pager->num_rows, 1, memory_order_relaxed);
+      }
+
+      cursor_close(&cursor);
+
+      if (duplicate || fits) {
+        return !duplicate;
+      }
+    }
+  }
+
+  table_lock(table, LATCH_EXCLUSIVE);
+  Cursor cursor;
+  if (!table_find_append(table, row->id, LATCH_NONE, &cursor)) {
+    table_find_by_key(table, row->id, &cursor);
+  }
+
+  void* node = get_page(pager, cursor.page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  bool duplicate = cursor.cell_num < num_cells &&
+                   *leaf_node_key(node, cursor.cell_num) == row->id;
+
+  if (!duplicate) {
+    leaf_node_insert(&cursor, row->id, row);
+  }
+
+  // the filter is rebuilt once outgrown, while nothing else is using it
+  if (filter_full(&table->filter)) {
+    table_build_filter(table);
+  }
+
+  table_unlock(table);
+  return !duplicate;
+}
+
+/**
+ * @brief Position a cursor, in storage the caller provides, on key within a
+ * leaf the caller has found.
+ */
+void leaf_node_find(Table* table, uint32_t page_num, void* node, uint64_t key,
+                    Cursor* cursor) {
   uint32_t num_cells = *leaf_node_num_cells(node);
 
-  Cursor* cursor = malloc(sizeof(Cursor));
   cursor->table = table;
   cursor->page_num = page_num;
+  cursor->node = node;
+  cursor->end = false;
+  cursor->latch = LATCH_NONE;
+  cursor->readahead = 0;
 
-  // perform binary search
-  uint32_t min_idx = 0;
-  uint32_t max_idx_plus_one = num_cells;
-
-  while (max_idx_plus_one != min_idx) {
-    uint32_t idx = (min_idx + max_idx_plus_one) / 2;
-    uint32_t idx_key = *leaf_node_key(node, idx);
+  // the matching cell, or where key would be inserted
+  cursor->cell_num = key_search(leaf_node_keys(node), num_cells, key);
+}
 
-    if (key == idx_key) {
-      cursor->cell_num = idx;
-      return cursor;
-    }
+/**
+ * @brief Move the cursor to key within its current leaf, for a key larger
+ * than one the leaf already holds. Return false if key may belong to a later
+ * leaf: only keys up to the leaf's largest, or any key in the rightmost leaf,
+ * which no separator bounds, are known to stay.
+ */
+bool leaf_node_reseek(Cursor* cursor, uint64_t key) {
+  void* node = get_page(cursor->table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
 
-    if (key < idx_key) {
-      max_idx_plus_one = idx;
-    } else {
-      min_idx = idx + 1;
-    }
+  if (*leaf_node_next_leaf(node) != 0 &&
+      (num_cells == 0 || key > *leaf_node_key(node, num_cells - 1))) {
+    return false;
   }
 
-  cursor->cell_num = min_idx;
-  return cursor;
+  cursor->cell_num = key_search(leaf_node_keys(node), num_cells, key);
+  return true;
 }
 
 uint32_t* get_parent_node(void* node) { return node + PARENT_POINTER_OFFSET; }
 
+uint32_t* get_next_index(void* node) { return node + NEXT_INDEX_OFFSET; }
+
 NodeType get_node_type(void* node) {
   uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
   return (NodeType)value;
@@ -274,68 +737,495 @@ void set_node_type(void* node, NodeType type) {
   *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
 }
 
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
+static uint32_t leaf_node_used_bytes(Pager* pager, void* node) {
+  return leaf_node_space_for_cells(pager) - leaf_node_free_bytes(node);
+}
+
+/**
+ * @brief Empty a leaf's cells while keeping its place in the tree.
+ */
+static void leaf_node_clear(Pager* pager, void* node) {
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_content_start(node) = pager->page_size;
+  *leaf_node_free_bytes_ptr(node) = leaf_node_space_for_cells(pager);
+}
+
+void leaf_node_split_and_insert(Cursor* cursor, uint64_t key, Row* value) {
+  atomic_fetch_add_explicit(&cursor->table->stats.leaf_splits, 1,
+                            memory_order_relaxed);
+
   // Create a new node
-  void* old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t old_max = get_node_max_key(old_node);
+  Pager* pager = cursor->table->pager;
+  void* old_node = get_page(pager, cursor->page_num);
+  uint64_t old_max = get_node_max_key(pager, old_node);
 
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void* new_node = get_page(cursor->table->pager, new_page_num);
-  leaf_node_init(new_node);
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  leaf_node_init(pager, new_node);
   *get_parent_node(new_node) = *get_parent_node(old_node);
 
+  // A key past the end of the rightmost leaf is most likely the first of many
+  // appends, which would leave a leaf split down the middle half empty for
+  // good; instead the old leaf keeps every cell and the new one starts afresh
+  bool append = *leaf_node_next_leaf(old_node) == 0 &&
+                cursor->cell_num == *leaf_node_num_cells(old_node);
+
   // After splitting, update the sibling pointers
   // where old sibling becomes new leaf,
   // new leaf's sibling is old leaf's sibling
   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
   *leaf_node_next_leaf(old_node) = new_page_num;
 
-  // Move half of the cells over.
-  // All extant keys plus new key will be divided evenly
-  // across the old (left) and new (right) nodes.
-  // Begin with the right, moving each key to its new position.
-  for (uint32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
-    void* destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+  // Rebuild the old (left) node from a copy, dividing all extant cells plus
+  // the new one between the two nodes by bytes rather than by count.
+  uint64_t copy_words[pager->page_size / sizeof(uint64_t)];
+  void* copy = copy_words;
+  memcpy(copy, old_node, pager->page_size);
+
+  uint32_t num_cells = *leaf_node_num_cells(copy);
+  uint32_t new_size = row_size(value);
+  uint32_t total = leaf_node_used_bytes(pager, copy) + LEAF_NODE_SLOT_SIZE +
+                   new_size;
+
+  leaf_node_clear(pager, old_node);
+
+  uint32_t left_bytes = 0;
+  void* destination_node = old_node;
+
+  for (uint32_t i = 0; i <= num_cells; i++) {
+    uint32_t src_idx = i < cursor->cell_num ? i : i - 1;
+    uint32_t size = i == cursor->cell_num
+                        ? new_size
+                        : serialized_row_size(leaf_node_value(copy, src_idx));
+    uint32_t bytes = LEAF_NODE_SLOT_SIZE + size;
+
+    // Move on to the right node once the left holds about half, leaving the
+    // right at least the last cell
+    if (destination_node == old_node && left_bytes > 0 &&
+        ((!append && left_bytes + bytes / 2 > total / 2) ||
+         i == num_cells)) {
       destination_node = new_node;
-    } else {
-      destination_node = old_node;
     }
 
-    uint32_t node_idx = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-    void* destination = leaf_node_cell(destination_node, node_idx);
+    if (destination_node == old_node) {
+      left_bytes += bytes;
+    }
+
+    uint32_t node_idx = *leaf_node_num_cells(destination_node);
 
     // Insert the new value in one of these two new nodes
     if (i == cursor->cell_num) {
-      serialize_row(value, leaf_node_value(destination_node, node_idx));
-      *leaf_node_key(destination_node, node_idx) = key;
-    } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+      leaf_node_put(pager, destination_node, node_idx, key, value);
     } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+      void* cell = leaf_node_alloc_cell(pager, destination_node, node_idx,
+                                        *leaf_node_key(copy, src_idx), size);
+      memcpy(cell, leaf_node_value(copy, src_idx), size);
     }
   }
 
-  // Update cell counts in each leaf node's header
-  *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-  *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+  pager_mark_dirty(pager, cursor->page_num);
+  pager_mark_dirty(pager, new_page_num);
 
   // Finally, update the parent or create a new one.
   // If the original node was the root node, it had no parent -
   // thus, we create a new root node i.e. parent.
   if (is_root_node(old_node)) {
-    return set_new_root(cursor->table, new_page_num);
+    set_new_root(cursor->table, new_page_num);
+    return;
   } else {
     // Update first key in the parent to be the max.
     // Add new child pointer / key pair, where the pointer
     // points to the new child node and the new key is that child's max.
     uint32_t parent_page_num = *get_parent_node(old_node);
-    uint32_t new_max = get_node_max_key(old_node);
-    void* parent = get_page(cursor->table->pager, parent_page_num);
+    uint64_t new_max = get_node_max_key(pager, old_node);
+    void* parent = get_page(pager, parent_page_num);
 
     internal_node_update_key(parent, old_max, new_max);
+    pager_mark_dirty(pager, parent_page_num);
     internal_node_insert(cursor->table, parent_page_num, new_page_num);
 
     return;
   }
 }
+
+static void node_shape(Table* table, uint32_t page_num, uint32_t depth,
+                       TreeShape* shape) {
+  if (depth >= BTREE_MAX_LEVELS) {
+    DIE("Tree deeper than %u levels\n", BTREE_MAX_LEVELS);
+  }
+
+  void* node = node_latch(table->pager, page_num, LATCH_SHARED);
+
+  shape->level_pages[depth]++;
+  if (depth >= shape->height) {
+    shape->height = depth + 1;
+  }
+
+  if (get_node_type(node) == NODE_LEAF) {
+    shape->leaf_bytes_used += leaf_node_used_bytes(table->pager, node);
+  } else {
+    uint32_t num_keys = *internal_node_num_keys(node);
+
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      node_shape(table, *internal_node_child(table->pager, node, i),
+                 depth + 1, shape);
+    }
+  }
+
+  pager_unlatch(table->pager, node, LATCH_SHARED);
+}
+
+/**
+ * @brief Walk every node of the table's tree, depth first with the table
+ * latched shared, counting the nodes at each level and the bytes the leaves
+ * hold.
+ */
+void table_shape(Table* table, TreeShape* shape) {
+  memset(shape, 0, sizeof(TreeShape));
+
+  table_lock(table, LATCH_SHARED);
+  node_shape(table, table->root_page_num, 0, shape);
+  table_unlock(table);
+}
+
+/**
+ * @brief Drop cell cell_num from a leaf, leaving its bytes as a hole unless
+ * it sat at the start of the cell content.
+ */
+static void leaf_node_remove(void* node, uint32_t cell_num) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t offset = *leaf_node_cell_offset(node, cell_num);
+  uint32_t size = serialized_row_size(node + offset);
+
+  // Shrinking the key array by one pulls every offset forward a key's width,
+  // and those after cell_num one place more
+  uint64_t* keys = leaf_node_keys(node);
+  uint32_t* offsets = (uint32_t*)(keys + num_cells);
+  uint32_t* new_offsets = (uint32_t*)(keys + num_cells - 1);
+  uint32_t after = num_cells - cell_num - 1;
+
+  memmove(keys + cell_num, keys + cell_num + 1, after * LEAF_NODE_KEY_SIZE);
+  memmove(new_offsets, offsets, cell_num * LEAF_NODE_CELL_OFFSET_SIZE);
+  memmove(new_offsets + cell_num, offsets + cell_num + 1,
+          after * LEAF_NODE_CELL_OFFSET_SIZE);
+
+  *leaf_node_num_cells(node) = num_cells - 1;
+  *leaf_node_free_bytes_ptr(node) += LEAF_NODE_SLOT_SIZE + size;
+
+  if (offset == *leaf_node_content_start(node)) {
+    *leaf_node_content_start(node) += size;
+  }
+}
+
+static void leaf_node_append_cells(Pager* pager, void* node, void* src,
+                                   uint32_t from, uint32_t to) {
+  for (uint32_t i = from; i < to; i++) {
+    void* cell = leaf_node_value(src, i);
+    uint32_t size = serialized_row_size(cell);
+
+    void* destination = leaf_node_alloc_cell(
+        pager, node, *leaf_node_num_cells(node), *leaf_node_key(src, i), size);
+    memcpy(destination, cell, size);
+  }
+}
+
+static uint32_t internal_node_child_index(Pager* pager, void* node,
+                                          uint32_t child_page_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    if (*internal_node_child(pager, node, i) == child_page_num) {
+      return i;
+    }
+  }
+
+  DIE("page %u is not a child of its parent\n", child_page_num);
+}
+
+/**
+ * @brief Drop key key_num and the child to its left from an internal node.
+ */
+static void internal_node_remove(Pager* pager, void* node, uint32_t key_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t after = num_keys - key_num - 1;
+
+  memmove(internal_node_keys(node) + key_num,
+          internal_node_keys(node) + key_num + 1,
+          after * INTERNAL_NODE_KEY_SIZE);
+  memmove(internal_node_children(pager, node) + key_num,
+          internal_node_children(pager, node) + key_num + 1,
+          after * INTERNAL_NODE_CHILD_SIZE);
+
+  *internal_node_num_keys(node) = num_keys - 1;
+}
+
+static void set_parents(Pager* pager, uint32_t* children, uint32_t n,
+                        uint32_t parent_page_num) {
+  for (uint32_t i = 0; i < n; i++) {
+    void* child = get_page(pager, children[i]);
+    *get_parent_node(child) = parent_page_num;
+    pager_mark_dirty(pager, children[i]);
+  }
+}
+
+/**
+ * @brief Merge adjacent leaves if their cells fit in one, else share the
+ * cells evenly by bytes. Returns whether the right leaf was merged away.
+ */
+static bool leaf_node_rebalance(Table* table, uint32_t parent_page_num,
+                                uint32_t left_idx) {
+  Pager* pager = table->pager;
+  void* parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num = *internal_node_child(pager, parent, left_idx);
+  uint32_t right_page_num = *internal_node_child(pager, parent, left_idx + 1);
+
+  void* left = get_page(pager, left_page_num);
+  void* right = get_page(pager, right_page_num);
+  uint32_t total =
+      leaf_node_used_bytes(pager, left) + leaf_node_used_bytes(pager, right);
+
+  if (total <= leaf_node_space_for_cells(pager)) {
+    leaf_node_append_cells(pager, left, right, 0, *leaf_node_num_cells(right));
+    *leaf_node_next_leaf(left) = *leaf_node_next_leaf(right);
+    pager_mark_dirty(pager, left_page_num);
+    pager_free_page(pager, right_page_num);
+
+    // The merged leaf takes the right leaf's place, and with it its key
+    parent = get_page(pager, parent_page_num);
+    internal_node_remove(pager, parent, left_idx);
+    *internal_node_child(pager, parent, left_idx) = left_page_num;
+    pager_mark_dirty(pager, parent_page_num);
+
+    return true;
+  }
+
+  uint64_t left_words[pager->page_size / sizeof(uint64_t)];
+  uint64_t right_words[pager->page_size / sizeof(uint64_t)];
+  void* left_copy = left_words;
+  void* right_copy = right_words;
+  memcpy(left_copy, left, pager->page_size);
+  memcpy(right_copy, right, pager->page_size);
+  leaf_node_clear(pager, left);
+  leaf_node_clear(pager, right);
+
+  uint32_t left_cells = *leaf_node_num_cells(left_copy);
+  uint32_t right_cells = *leaf_node_num_cells(right_copy);
+  uint32_t left_bytes = 0;
+  void* destination_node = left;
+
+  for (uint32_t i = 0; i < left_cells + right_cells; i++) {
+    void* src = i < left_cells ? left_copy : right_copy;
+    uint32_t src_idx = i < left_cells ? i : i - left_cells;
+    uint32_t bytes = LEAF_NODE_SLOT_SIZE +
+                     serialized_row_size(leaf_node_value(src, src_idx));
+
+    if (destination_node == left && left_bytes > 0 &&
+        left_bytes + bytes / 2 > total / 2) {
+      destination_node = right;
+    }
+
+    if (destination_node == left) {
+      left_bytes += bytes;
+    }
+
+    leaf_node_append_cells(pager, destination_node, src, src_idx, src_idx + 1);
+  }
+
+  *internal_node_key(parent, left_idx) =
+      *leaf_node_key(left, *leaf_node_num_cells(left) - 1);
+
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  return false;
+}
+
+/**
+ * @brief Merge adjacent internal nodes if their children fit in one, else
+ * share the children evenly. The parent's key between the two bounds the left
+ * node's last child once they are combined. Returns whether the right node
+ * was merged away.
+ */
+static bool internal_node_rebalance(Table* table, uint32_t parent_page_num,
+                                    uint32_t left_idx) {
+  Pager* pager = table->pager;
+  uint32_t max_cells = internal_node_max_cells(pager);
+  uint32_t children[2 * (max_cells + 1)];
+  uint64_t keys[2 * (max_cells + 1)];
+
+  void* parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num = *internal_node_child(pager, parent, left_idx);
+  uint32_t right_page_num = *internal_node_child(pager, parent, left_idx + 1);
+  uint64_t separator = *internal_node_key(parent, left_idx);
+
+  void* left = get_page(pager, left_page_num);
+  void* right = get_page(pager, right_page_num);
+  uint32_t left_keys = *internal_node_num_keys(left);
+  uint32_t right_keys = *internal_node_num_keys(right);
+  uint32_t left_count = left_keys + 1;
+  uint32_t count = left_count + right_keys + 1;
+
+  memcpy(children, internal_node_children(pager, left),
+         left_keys * INTERNAL_NODE_CHILD_SIZE);
+  memcpy(keys, internal_node_keys(left), left_keys * INTERNAL_NODE_KEY_SIZE);
+  children[left_keys] = *internal_node_right_child(left);
+  keys[left_keys] = separator;
+
+  memcpy(children + left_count, internal_node_children(pager, right),
+         right_keys * INTERNAL_NODE_CHILD_SIZE);
+  memcpy(keys + left_count, internal_node_keys(right),
+         right_keys * INTERNAL_NODE_KEY_SIZE);
+  children[count - 1] = *internal_node_right_child(right);
+
+  if (count <= max_cells + 1) {
+    internal_node_fill(pager, left, children, keys, count);
+    pager_mark_dirty(pager, left_page_num);
+    pager_free_page(pager, right_page_num);
+
+    parent = get_page(pager, parent_page_num);
+    internal_node_remove(pager, parent, left_idx);
+    *internal_node_child(pager, parent, left_idx) = left_page_num;
+    pager_mark_dirty(pager, parent_page_num);
+
+    set_parents(pager, children + left_count, count - left_count,
+                left_page_num);
+    return true;
+  }
+
+  uint32_t half = count / 2;
+
+  internal_node_fill(pager, left, children, keys, half);
+  internal_node_fill(pager, right, children + half, keys + half, count - half);
+  *internal_node_key(parent, left_idx) = keys[half - 1];
+
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  // Only the children that changed sides need a new parent pointer
+  if (half > left_count) {
+    set_parents(pager, children + left_count, half - left_count,
+                left_page_num);
+  } else {
+    set_parents(pager, children + half, left_count - half, right_page_num);
+  }
+
+  return false;
+}
+
+/**
+ * @brief Shrink the tree by a level while the root has a single child, moving
+ * that child into the root page. The head of the root's list of indexes is
+ * kept.
+ */
+static void collapse_root(Table* table) {
+  Pager* pager = table->pager;
+  void* root = get_page(pager, table->root_page_num);
+
+  while (get_node_type(root) == NODE_INTERNAL &&
+         *internal_node_num_keys(root) == 0) {
+    uint32_t child_page_num = *internal_node_right_child(root);
+    void* child = get_page(pager, child_page_num);
+    uint32_t index_head = *get_next_index(root);
+
+    memcpy(root, child, pager->page_size);
+    set_root_node(root, true);
+    *get_parent_node(root) = 0;
+    *get_next_index(root) = index_head;
+    pager_mark_dirty(pager, table->root_page_num);
+    pager_free_page(pager, child_page_num);
+
+    root = get_page(pager, table->root_page_num);
+    if (get_node_type(root) == NODE_INTERNAL) {
+      uint32_t num_keys = *internal_node_num_keys(root);
+      uint32_t grandchildren[internal_node_max_cells(pager) + 1];
+
+      memcpy(grandchildren, internal_node_children(pager, root),
+             num_keys * INTERNAL_NODE_CHILD_SIZE);
+      grandchildren[num_keys] = *internal_node_right_child(root);
+
+      set_parents(pager, grandchildren, num_keys + 1, table->root_page_num);
+      root = get_page(pager, table->root_page_num);
+    }
+  }
+}
+
+/*
+Restore the fill of an underfull non-root node by pairing it with the sibling
+to its right (or, for the right-most child, its left) under the same parent.
+A merge removes a child from the parent, which may leave the parent underfull
+in turn, so the repair walks up the tree until a node has enough children or
+the root is reached. Separator keys left behind by removed cells stay valid
+upper bounds, so only merges and borrows touch the parent's keys.
+*/
+static void node_rebalance(Table* table, uint32_t page_num) {
+  Pager* pager = table->pager;
+
+  while (1) {
+    void* node = get_page(pager, page_num);
+    bool is_leaf = get_node_type(node) == NODE_LEAF;
+    uint32_t parent_page_num = *get_parent_node(node);
+
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    if (num_keys == 0) {
+      // no sibling to pair with
+      return;
+    }
+
+    uint32_t idx = internal_node_child_index(pager, parent, page_num);
+    uint32_t left_idx = idx < num_keys ? idx : idx - 1;
+
+    bool merged = is_leaf
+                      ? leaf_node_rebalance(table, parent_page_num, left_idx)
+                      : internal_node_rebalance(table, parent_page_num,
+                                                left_idx);
+    if (!merged) {
+      return;
+    }
+
+    parent = get_page(pager, parent_page_num);
+
+    if (is_root_node(parent)) {
+      collapse_root(table);
+      return;
+    }
+
+    // Below a quarter full a non-root node is merged or borrows in turn
+    if (*internal_node_num_keys(parent) + 1 >=
+        (internal_node_max_cells(pager) + 1) / 4) {
+      return;
+    }
+
+    page_num = parent_page_num;
+  }
+}
+
+/**
+ * @brief Remove the cell under the cursor and its index entries, rebalancing
+ * the leaf if that leaves it underfull.
+ */
+void leaf_node_delete(Cursor* cursor) {
+  Pager* pager = cursor->table->pager;
+  void* node = get_page(pager, cursor->page_num);
+
+  if (table_has_indexes(cursor->table)) {
+    Row row;
+    deserialize_row(leaf_node_value(node, cursor->cell_num), &row);
+    index_delete_row(cursor->table, &row);
+    node = get_page(pager, cursor->page_num);
+  }
+
+  leaf_node_remove(node, cursor->cell_num);
+  pager_mark_dirty(pager, cursor->page_num);
+  atomic_fetch_sub_explicit(&pager->num_rows, 1, memory_order_relaxed);
+
+  // Below a quarter full a non-root leaf is merged or borrows
+  if (is_root_node(node) || leaf_node_used_bytes(pager, node) >=
+                                leaf_node_space_for_cells(pager) / 4) {
+    return;
+  }
+
+  node_rebalance(cursor->table, cursor->page_num);
+}
@@ -5,14 +5,34 @@
 
 #include "pager.h"
 
+/**
+ * @brief Upper bound on tree height; a fanout of two or more cannot exceed it
+ * with 32-bit page numbers.
+ */
+#define BTREE_MAX_LEVELS 32
+
+/**
+ * @brief The shape of a table's tree, as found by table_shape.
+ */
+typedef struct {
+  uint32_t height;
+  uint32_t level_pages[BTREE_MAX_LEVELS];  // nodes at each depth, root first
+  uint64_t leaf_bytes_used;  // by cells and their slots, in every leaf
+} TreeShape;
+
 static const uint32_t NODE_TYPE_SIZE = sizeof(uint32_t);  // uint8?
 static const uint32_t NODE_TYPE_OFFSET = 0;
 static const uint32_t IS_ROOT_SIZE = sizeof(uint32_t);  // uint8?
 static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
 static const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 static const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
+// The roots of the table and its indexes form a list: the table root points
+// at the first index root and each index root at the next, with 0 ending it
+static const uint32_t NEXT_INDEX_SIZE = sizeof(uint32_t);
+static const uint32_t NEXT_INDEX_OFFSET =
+    PARENT_POINTER_OFFSET + PARENT_POINTER_SIZE;
 static const uint8_t COMMON_NODE_HEADER_SIZE =
-    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE + NEXT_INDEX_SIZE;
 
 static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
@@ -20,26 +40,30 @@ static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
     LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-static const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                              LEAF_NODE_NUM_CELLS_SIZE +
-                                              LEAF_NODE_NEXT_LEAF_SIZE;
-
-static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-static const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-static const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-static const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-static const uint32_t LEAF_NODE_CELL_SIZE =
-    LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-static const uint32_t LEAF_NODE_SPACE_FOR_CELLS =
-    PAGE_SIZE + LEAF_NODE_HEADER_SIZE;
-static const uint32_t LEAF_NODE_MAX_CELLS =
-    LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-
-static const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) / 2;
-static const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+static const uint32_t LEAF_NODE_CONTENT_START_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_CONTENT_START_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+static const uint32_t LEAF_NODE_FREE_BYTES_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_FREE_BYTES_OFFSET =
+    LEAF_NODE_CONTENT_START_OFFSET + LEAF_NODE_CONTENT_START_SIZE;
+static const uint32_t LEAF_NODE_HEADER_SIZE =
+    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE +
+    LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_CONTENT_START_SIZE +
+    LEAF_NODE_FREE_BYTES_SIZE;
+
+/*
+A leaf is a slotted page. Its directory, which grows up from the header, is the
+array of all keys in order followed by the array of their cells' offsets; the
+variable-length rows those point at grow down from the end of the page. Keeping
+the keys contiguous lets a search scan them without touching anything else.
+Free space lies between the directory and the rows, plus any holes left by
+removed cells, which compaction folds back into the gap.
+*/
+static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint64_t);
+static const uint32_t LEAF_NODE_KEYS_OFFSET = LEAF_NODE_HEADER_SIZE;
+static const uint32_t LEAF_NODE_CELL_OFFSET_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_SLOT_SIZE =
+    LEAF_NODE_KEY_SIZE + LEAF_NODE_CELL_OFFSET_SIZE;
 
 static const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 static const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
@@ -50,27 +74,71 @@ static const uint32_t INTERNAL_NODE_HEADER_SIZE =
     COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE +
     INTERNAL_NODE_RIGHT_CHILD_SIZE;
 
-static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+static const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint64_t);
 static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 static const uint32_t INTERNAL_NODE_CELL_SIZE =
     INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-static const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
 
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key);
+// Keys fill a fixed-size array after the header, and the children they bound
+// a second array after that; both are as long as the page size allows (see
+// internal_node_max_cells)
+static const uint32_t INTERNAL_NODE_KEYS_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+
+uint32_t leaf_node_space_for_cells(Pager* pager);
+
+uint32_t internal_node_max_cells(Pager* pager);
+
+void internal_node_init(void* node);
+
+uint32_t* internal_node_num_keys(void* node);
+
+uint32_t* internal_node_right_child(void* node);
+
+uint32_t* internal_node_child(Pager* pager, void* node, uint32_t child_num);
+
+uint64_t* internal_node_key(void* node, uint32_t key_num);
+
+void internal_node_fill(Pager* pager, void* node, uint32_t* children,
+                        uint64_t* keys, uint32_t n);
+
+void* node_latch(Pager* pager, uint32_t page_num, LatchMode leaf_mode);
+
+void internal_node_find(Table* table, void* node, uint64_t key,
+                        LatchMode mode, Cursor* cursor);
+
+uint32_t internal_node_find_child(void* node, uint64_t key);
+
+void leaf_node_init(Pager* pager, void* node);
 
-Cursor* internal_node_find_child(void* node, uint32_t key);
+void leaf_node_insert(Cursor* cursor, uint64_t key, Row* value);
 
-void leaf_node_init(void* node);
+void table_build_filter(Table* table);
 
-void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value);
+bool table_may_contain(Table* table, uint64_t id);
+
+bool table_insert(Table* table, Row* row);
 
 uint32_t* leaf_node_num_cells(void* node);
 
-uint32_t* leaf_node_key(void* node, uint32_t cell_num);
+uint32_t leaf_node_free_bytes(void* node);
+
+bool leaf_node_fits(void* node, Row* value);
+
+void leaf_node_put(Pager* pager, void* node, uint32_t cell_num, uint64_t key,
+                   Row* value);
+
+void leaf_node_compact(Pager* pager, void* node);
+
+uint64_t* leaf_node_keys(void* node);
+
+uint64_t* leaf_node_key(void* node, uint32_t cell_num);
 
 void* leaf_node_value(void* node, uint32_t cell_num);
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key);
+void leaf_node_find(Table* table, uint32_t page_num, void* node, uint64_t key,
+                    Cursor* cursor);
+
+bool leaf_node_reseek(Cursor* cursor, uint64_t key);
 
 uint32_t* leaf_node_next_leaf(void* node);
 
@@ -78,12 +146,25 @@ NodeType get_node_type(void* node);
 
 void set_node_type(void* node, NodeType type);
 
+bool is_root_node(void* node);
+
 void set_root_node(void* node, bool is_root);
 
+void set_new_root(Table* table, uint32_t right_child_page_num);
+
 uint32_t* get_parent_node(void* node);
 
-uint32_t get_node_max_key(void* node);
+uint32_t* get_next_index(void* node);
+
+uint64_t get_node_max_key(Pager* pager, void* node);
+
+void leaf_node_split_and_insert(Cursor* cursor, uint64_t key, Row* value);
+
+void leaf_node_delete(Cursor* cursor);
+
+void table_shape(Table* table, TreeShape* shape);
 
-void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value);
+void internal_node_split_and_insert(Table* table, uint32_t page_num,
+                                    uint32_t child_page_num);
 
 #endif /* BTREE_H */
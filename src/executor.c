@@ -1,52 +1,572 @@
 #include "executor.h"
 
 #include <stdint.h>
-#include <stdio.h>
+#include <string.h>
 
 #include "btree.h"
+#include "index.h"
+#include "output.h"
 #include "pager.h"
+#include "scan.h"
+#include "search.h"
 
+// Orders rows by id, and rows sharing an id by their place in the statement
+static int compare_row_ids(const void* a, const void* b) {
+  Row* ra = *(Row**)a;
+  Row* rb = *(Row**)b;
+
+  if (ra->id != rb->id) {
+    return (ra->id > rb->id) - (ra->id < rb->id);
+  }
+
+  return (ra > rb) - (ra < rb);
+}
+
+/**
+ * @brief Insert the statement's rows in id order in one pass. The cursor
+ * stays on its leaf while the next id still belongs there, so runs of
+ * nearby ids skip the descent from the root. Ids already present, or
+ * repeated later in the batch, are skipped and counted in duplicates, and
+ * the rest of the batch still succeeds, as it does for .import; only a
+ * single row fails on a duplicate. A single row is inserted optimistically,
+ * alongside other threads; a batch latches the table exclusively for its
+ * pass.
+ */
 ExecutionResult execute_insert(Statement* statement, Table* table) {
-  void* node = get_page(table->pager, table->root_page_num);
+  uint32_t num_rows = statement->num_rows;
 
-  uint32_t num_cells = (*leaf_node_num_cells(node));
+  statement->duplicates = 0;
+
+  if (num_rows == 1) {
+    return table_insert(table, &statement->rows[0]) ? EXECUTE_SUCCESS
+                                                   : EXECUTE_DUPLICATE_KEY;
+  }
+
+  Row** order = arena_alloc(&statement->arena, num_rows * sizeof(Row*));
+  bool positioned = false;  // whether cursor is on a leaf still current
+  Cursor cursor;
+
+  for (uint32_t i = 0; i < num_rows; i++) {
+    order[i] = &statement->rows[i];
+  }
+
+  qsort(order, num_rows, sizeof(Row*), compare_row_ids);
+  table_lock(table, LATCH_EXCLUSIVE);
+
+  for (uint32_t i = 0; i < num_rows; i++) {
+    Row* row = order[i];
+
+    if (positioned && !leaf_node_reseek(&cursor, row->id)) {
+      positioned = false;
+    }
+
+    if (!positioned) {
+      table_find_by_key(table, row->id, &cursor);
+      positioned = true;
+    }
+
+    void* node = get_page(table->pager, cursor.page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    if (cursor.cell_num < num_cells &&
+        *leaf_node_key(node, cursor.cell_num) == row->id) {
+      statement->duplicates++;
+      continue;
+    }
 
-  Row* row = &(statement->row);
-  uint32_t key = row->id;
-  Cursor* cursor = table_find_by_key(table, key);
+    // A split moves rows to a new leaf, so find the next one from the root
+    bool split = !leaf_node_fits(node, row);
+    leaf_node_insert(&cursor, row->id, row);
 
-  if (cursor->cell_num < num_cells) {
-    if (*leaf_node_key(node, cursor->cell_num) == key) {
-      return EXECUTE_DUPLICATE_KEY;
+    if (split) {
+      positioned = false;
     }
   }
 
-  leaf_node_insert(cursor, row->id, row);
+  if (filter_full(&table->filter)) {
+    table_build_filter(table);
+  }
 
-  free(cursor);
+  table_unlock(table);
   return EXECUTE_SUCCESS;
 }
 
+/**
+ * @brief Whether the statement's range is a single id that the key filter
+ * says is not in the table, so there is no need to look for it.
+ */
+static bool range_is_absent(Statement* statement, Table* table) {
+  return statement->id_min == statement->id_max &&
+         !table_may_contain(table, statement->id_min);
+}
+
+/**
+ * @brief Where the rows of one scanning thread go, and the column value they
+ * must hold when the select has one.
+ */
+typedef struct {
+  Statement* statement;
+  OutputQueue* queue;  // NULL on the thread that writes the output
+} SelectState;
+
+static bool row_matches(Statement* statement, Row* row) {
+  return !statement->by_column ||
+         strcmp(row_column(row, statement->column), statement->value) == 0;
+}
+
+static void select_row(void* state, Row* row) {
+  SelectState* select = state;
+
+  if (!row_matches(select->statement, row)) {
+    return;
+  }
+
+  if (select->queue) {
+    output_queue_row(select->queue, row);
+  } else {
+    output_row(row);
+  }
+}
+
+static void select_queue_close(void* state) {
+  output_queue_close(((SelectState*)state)->queue);
+}
+
+static bool select_queue_full(void* state) {
+  return output_queue_full(((SelectState*)state)->queue);
+}
+
+static void select_queue_wait(void* state) {
+  output_queue_wait(((SelectState*)state)->queue);
+}
+
+/**
+ * @brief Output rows with ids in [id_min, id_max], seeking straight to id_min
+ * and stopping at the first id past id_max. A large range is split across
+ * threads: each formats its own part of the range, and this thread writes the
+ * parts out in id order, its own first. The other threads wait between leaves
+ * once they are OUTPUT_QUEUE_CHUNKS chunks ahead of the output. Rows selected by a column value are
+ * looked up through the column's index if it has one, and otherwise filtered
+ * out of a scan of the whole table. An id the key filter rules out is answered
+ * without a look at the tree.
+ */
 ExecutionResult execute_select(Statement* statement, Table* table) {
-  Row row;
-  Cursor* cursor = cursor_start_init(table);
-  while (!(cursor->end)) {
-    deserialize_row(cursor_value(cursor), &row);
-    printf("(%d, %s, %s)\n", row.id, row.username, row.email);
-    cursor_advance(cursor);
+  if (statement->aggregate != AGGREGATE_NONE) {
+    return execute_aggregate(statement, table);
   }
 
-  free(cursor);
+  if (range_is_absent(statement, table)) {
+    output_end();
+    return EXECUTE_SUCCESS;
+  }
+
+  SelectState states[SCAN_MAX_THREADS];
+  states[0] = (SelectState){.statement = statement, .queue = NULL};
+
+  if (statement->by_column &&
+      index_lookup(table, statement->column, statement->value,
+                   &statement->arena, select_row, &states[0])) {
+    output_end();
+    return EXECUTE_SUCCESS;
+  }
+
+  ScanRange ranges[SCAN_MAX_THREADS];
+  ScanWorker workers[SCAN_MAX_THREADS];
+  OutputQueue queues[SCAN_MAX_THREADS];
+  uint32_t n = scan_split(table, statement->id_min, statement->id_max,
+                          &statement->arena, ranges);
+
+  for (uint32_t i = 1; i < n; i++) {
+    output_queue_init(&queues[i]);
+    states[i] = (SelectState){.statement = statement, .queue = &queues[i]};
+    workers[i] = (ScanWorker){
+        .table = table,
+        .range = ranges[i],
+        .visit = select_row,
+        .finish = select_queue_close,
+        .backlogged = select_queue_full,
+        .wait = select_queue_wait,
+        .state = &states[i],
+    };
+    scan_start(&workers[i]);
+  }
+
+  scan_range(table, ranges[0], select_row, &states[0]);
+
+  for (uint32_t i = 1; i < n; i++) {
+    output_queue_drain(&queues[i]);
+    scan_join(&workers[i]);
+  }
+
+  output_end();
   return EXECUTE_SUCCESS;
 }
 
+/**
+ * @brief Count the ids in [id_min, id_max] a leaf at a time, adding them up
+ * too if sum is set, and noting in overflow whether the sum wrapped. A count
+ * needs only the leaf headers, save for the last leaf, whose keys say where
+ * the range ends; rows are never deserialized.
+ */
+static uint64_t aggregate_leaves(Table* table, uint64_t id_min,
+                                 uint64_t id_max, uint64_t* sum,
+                                 bool* overflow) {
+  uint64_t count = 0;
+  Cursor cursor;
+
+  table_scan(table, id_min, &cursor);
+
+  while (!(cursor.end)) {
+    void* node = cursor_node(&cursor);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t* keys = leaf_node_keys(node);
+    uint32_t start = cursor.cell_num;
+    uint32_t end = num_cells;
+
+    if (keys[num_cells - 1] > id_max) {
+      end = start + key_search(keys + start, num_cells - start, id_max + 1);
+    }
+
+    count += end - start;
+    for (uint32_t i = start; sum && i < end; i++) {
+      *overflow |= __builtin_add_overflow(*sum, keys[i], sum);
+    }
+
+    if (end < num_cells) {
+      break;
+    }
+
+    cursor_skip_leaf(&cursor);
+  }
+
+  cursor_close(&cursor);
+  return count;
+}
+
+/**
+ * @brief Find the smallest id in [id_min, id_max]: the first row a seek to
+ * id_min lands on.
+ */
+static bool aggregate_min(Table* table, uint64_t id_min, uint64_t id_max,
+                          uint64_t* id) {
+  Cursor cursor;
+  bool found = false;
+
+  table_scan(table, id_min, &cursor);
+
+  if (!(cursor.end)) {
+    *id = *leaf_node_key(cursor_node(&cursor), cursor.cell_num);
+    found = *id <= id_max;
+  }
+
+  cursor_close(&cursor);
+  return found;
+}
+
+/**
+ * @brief Find the largest id no greater than id_max under a node. The descent
+ * follows id_max, which for an unbounded max is the right child all the way
+ * down, and only backs up into a left sibling when a leaf holds nothing small
+ * enough. Nodes stay latched shared while their children are searched.
+ */
+static bool aggregate_max(Pager* pager, uint32_t page_num, uint64_t id_max,
+                          uint64_t* id) {
+  void* node = node_latch(pager, page_num, LATCH_SHARED);
+  bool found = false;
+
+  if (get_node_type(node) == NODE_LEAF) {
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint64_t* keys = leaf_node_keys(node);
+    uint32_t idx = key_search(keys, num_cells, id_max);
+
+    if (idx < num_cells && keys[idx] == id_max) {
+      idx++;
+    }
+
+    if (idx > 0) {
+      *id = keys[idx - 1];
+      found = true;
+    }
+  } else {
+    uint32_t child_idx = id_max == UINT64_MAX
+                             ? *internal_node_num_keys(node)
+                             : internal_node_find_child(node, id_max);
+
+    for (uint32_t i = child_idx + 1; i-- > 0 && !found;) {
+      found = aggregate_max(pager, *internal_node_child(pager, node, i),
+                            id_max, id);
+    }
+  }
+
+  pager_unlatch(pager, node, LATCH_SHARED);
+  return found;
+}
+
+/**
+ * @brief The running count, sum, min and max of the ids of the rows one
+ * scanning thread has seen holding the select's column value.
+ */
+typedef struct {
+  Statement* statement;
+  uint64_t count;
+  uint64_t sum;
+  bool overflow;  // whether sum wrapped
+  uint64_t min;
+  uint64_t max;
+} Accumulator;
+
+static void accumulate_row(void* state, Row* row) {
+  Accumulator* acc = state;
+
+  if (!row_matches(acc->statement, row)) {
+    return;
+  }
+
+  // rows come in id order
+  if (acc->count == 0) {
+    acc->min = row->id;
+  }
+
+  acc->max = row->id;
+  acc->overflow |= __builtin_add_overflow(acc->sum, row->id, &acc->sum);
+  acc->count++;
+}
+
+/**
+ * @brief Aggregate the ids of the rows holding the select's column value,
+ * through the column's index if it has one, or by scanning the table on as
+ * many threads as a select would.
+ */
+static void aggregate_by_column(Statement* statement, Table* table,
+                                Accumulator* total) {
+  *total = (Accumulator){.statement = statement};
+
+  if (index_lookup(table, statement->column, statement->value,
+                   &statement->arena, accumulate_row, total)) {
+    return;
+  }
+
+  ScanRange ranges[SCAN_MAX_THREADS];
+  ScanWorker workers[SCAN_MAX_THREADS];
+  Accumulator accs[SCAN_MAX_THREADS];
+  uint32_t n = scan_split(table, statement->id_min, statement->id_max,
+                          &statement->arena, ranges);
+
+  for (uint32_t i = 1; i < n; i++) {
+    accs[i] = (Accumulator){.statement = statement};
+    workers[i] = (ScanWorker){
+        .table = table,
+        .range = ranges[i],
+        .visit = accumulate_row,
+        .state = &accs[i],
+    };
+    scan_start(&workers[i]);
+  }
+
+  scan_range(table, ranges[0], accumulate_row, total);
+
+  // ranges are in id order, so the first to see a row has the min
+  for (uint32_t i = 1; i < n; i++) {
+    scan_join(&workers[i]);
+
+    if (accs[i].count) {
+      total->min = total->count ? total->min : accs[i].min;
+      total->max = accs[i].max;
+      total->overflow |= accs[i].overflow ||
+                         __builtin_add_overflow(total->sum, accs[i].sum,
+                                                &total->sum);
+      total->count += accs[i].count;
+    }
+  }
+}
+
+/**
+ * @brief Output an aggregate's value, or none for a sum that overflowed.
+ */
+static ExecutionResult aggregate_output(const uint64_t* value, bool overflow) {
+  if (!overflow) {
+    output_value(value);
+  }
+
+  output_end();
+  return overflow ? EXECUTE_SUM_OVERFLOW : EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief Output count(*), min(id), max(id) or sum(id) over the rows with ids
+ * in [id_min, id_max], computed from the keys alone, or over the rows holding
+ * a column value; a count of every row is the one the header keeps. The min
+ * or max of no rows has no value; the sum of no rows is none either, as in
+ * SQL. A sum too large for 64 bits fails the statement rather than wrap.
+ */
+ExecutionResult execute_aggregate(Statement* statement, Table* table) {
+  uint64_t id_min = statement->id_min;
+  uint64_t id_max = statement->id_max;
+  uint64_t value = 0;
+  uint64_t id = 0;
+  bool found = true;
+  bool overflow = false;
+
+  if (statement->by_column) {
+    Accumulator acc;
+    aggregate_by_column(statement, table, &acc);
+
+    value = statement->aggregate == AGGREGATE_MIN   ? acc.min
+            : statement->aggregate == AGGREGATE_MAX ? acc.max
+            : statement->aggregate == AGGREGATE_SUM ? acc.sum
+                                                    : acc.count;
+    found = acc.count > 0 || statement->aggregate == AGGREGATE_COUNT;
+    overflow = statement->aggregate == AGGREGATE_SUM && acc.overflow;
+    return aggregate_output(found ? &value : NULL, overflow);
+  }
+
+  if (range_is_absent(statement, table)) {
+    found = statement->aggregate == AGGREGATE_COUNT;
+    output_value(found ? &value : NULL);
+    output_end();
+    return EXECUTE_SUCCESS;
+  }
+
+  switch (statement->aggregate) {
+    case AGGREGATE_NONE:
+    case AGGREGATE_COUNT:
+      // the header keeps the number of rows, so counting them all is free
+      value = id_min == 0 && id_max == UINT64_MAX
+                  ? atomic_load_explicit(&table->pager->num_rows,
+                                         memory_order_relaxed)
+                  : aggregate_leaves(table, id_min, id_max, NULL, NULL);
+      break;
+    case AGGREGATE_SUM:
+      found = aggregate_leaves(table, id_min, id_max, &value, &overflow) > 0;
+      break;
+    case AGGREGATE_MIN:
+      found = aggregate_min(table, id_min, id_max, &id);
+      value = id;
+      break;
+    case AGGREGATE_MAX:
+      table_lock(table, LATCH_SHARED);
+      found = aggregate_max(table->pager, table->root_page_num, id_max, &id) &&
+              id >= id_min;
+      table_unlock(table);
+      value = id;
+      break;
+  }
+
+  return aggregate_output(found ? &value : NULL, overflow);
+}
+
+/**
+ * @brief Remove every row with an id in [id_min, id_max]. Each removal may
+ * reshape the tree, so the next row is found by seeking past the last id.
+ * Deleting an id the key filter rules out does not latch the table at all.
+ */
+ExecutionResult execute_delete(Statement* statement, Table* table) {
+  uint64_t id = statement->id_min;
+
+  if (range_is_absent(statement, table)) {
+    return EXECUTE_SUCCESS;
+  }
+
+  table_lock(table, LATCH_EXCLUSIVE);
+
+  while (1) {
+    Cursor cursor;
+    table_seek(table, id, &cursor);
+
+    if (cursor.end) {
+      break;
+    }
+
+    void* node = get_page(table->pager, cursor.page_num);
+    uint64_t key = *leaf_node_key(node, cursor.cell_num);
+    if (key > statement->id_max) {
+      break;
+    }
+
+    leaf_node_delete(&cursor);
+
+    if (key == UINT64_MAX) {
+      break;
+    }
+
+    id = key + 1;
+  }
+
+  table_unlock(table);
+  return EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief Index a column of every row, keeping the index up to date from then
+ * on. Building it latches the table exclusively.
+ */
+ExecutionResult execute_create_index(Statement* statement, Table* table) {
+  table_lock(table, LATCH_EXCLUSIVE);
+  bool created = index_create(table, statement->column);
+  table_unlock(table);
+
+  return created ? EXECUTE_SUCCESS : EXECUTE_INDEX_EXISTS;
+}
+
+ExecutionResult execute_begin(Statement* statement, Table* table) {
+  (void)statement;
+
+  if (table->pager->in_transaction) {
+    return EXECUTE_TRANSACTION_OPEN;
+  }
+
+  pager_begin(table->pager);
+  return EXECUTE_SUCCESS;
+}
+
+ExecutionResult execute_commit(Statement* statement, Table* table) {
+  (void)statement;
+
+  if (!table->pager->in_transaction) {
+    return EXECUTE_NO_TRANSACTION;
+  }
+
+  pager_commit(table->pager);
+  return EXECUTE_SUCCESS;
+}
+
+/**
+ * @brief Run a prepared statement, then give back all the scratch memory it
+ * took from its arena.
+ */
 ExecutionResult execute_statement(Statement* statement, Table* table) {
+  ExecutionResult result = EXECUTE_SUCCESS;
+  bool writes = true;
+
   switch (statement->type) {
     case STATEMENT_INSERT:
-      return execute_insert(statement, table);
+      result = execute_insert(statement, table);
+      break;
     case STATEMENT_SELECT:
-      return execute_select(statement, table);
+      result = execute_select(statement, table);
+      writes = false;
+      break;
+    case STATEMENT_DELETE:
+      result = execute_delete(statement, table);
+      break;
+    case STATEMENT_CREATE_INDEX:
+      result = execute_create_index(statement, table);
+      break;
+    case STATEMENT_BEGIN:
+      result = execute_begin(statement, table);
+      writes = false;
+      break;
+    case STATEMENT_COMMIT:
+      result = execute_commit(statement, table);
+      writes = false;
+      break;
+  }
+
+  // Outside an explicit transaction each statement commits on its own
+  if (writes && !table->pager->in_transaction) {
+    pager_commit(table->pager);
   }
 
-  return EXECUTE_SUCCESS;  // todo
+  arena_reset(&statement->arena);
+  return result;
 }
@@ -8,12 +8,26 @@ typedef enum {
   EXECUTE_SUCCESS,
   EXECUTE_TABLE_FULL,
   EXECUTE_DUPLICATE_KEY,
+  EXECUTE_TRANSACTION_OPEN,
+  EXECUTE_NO_TRANSACTION,
+  EXECUTE_INDEX_EXISTS,
+  EXECUTE_SUM_OVERFLOW,
 } ExecutionResult;
 
 ExecutionResult execute_insert(Statement* statement, Table* table);
 
 ExecutionResult execute_select(Statement* statement, Table* table);
 
+ExecutionResult execute_aggregate(Statement* statement, Table* table);
+
+ExecutionResult execute_delete(Statement* statement, Table* table);
+
+ExecutionResult execute_create_index(Statement* statement, Table* table);
+
+ExecutionResult execute_begin(Statement* statement, Table* table);
+
+ExecutionResult execute_commit(Statement* statement, Table* table);
+
 ExecutionResult execute_statement(Statement* statement, Table* table);
 
 #endif /* EXECUTOR_H */
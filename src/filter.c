@@ -0,0 +1,131 @@
+#include "filter.h"
+
+#include <stdlib.h>
+
+#include "common.h"
+
+// Odd multipliers picking the bit each word of a block gets for a key
+static const uint32_t FILTER_SALTS[FILTER_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+};
+
+// sequential ids would otherwise crowd into neighbouring blocks
+static uint64_t filter_hash(uint64_t key) {
+  uint64_t x = key + 0x9e3779b97f4a7c15u;
+
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return x ^ (x >> 31);
+}
+
+static _Atomic uint32_t* filter_block(KeyFilter* filter, uint64_t key) {
+  uint64_t run = filter_hash(key >> FILTER_RUN_BITS);
+
+  return filter->blocks + (run & filter->block_mask) * FILTER_BLOCK_WORDS;
+}
+
+/**
+ * @brief Size an empty filter for num_keys keys and as many again, rounding
+ * up to a power of two blocks.
+ */
+void filter_init(KeyFilter* filter, uint64_t num_keys) {
+  uint64_t capacity = num_keys < UINT64_MAX / 2 ? num_keys * 2 : UINT64_MAX;
+
+  if (capacity < FILTER_MIN_KEYS) {
+    capacity = FILTER_MIN_KEYS;
+  }
+
+  // counted in blocks rather than bits, so that no product can overflow
+  uint64_t keys_per_block = FILTER_BLOCK_WORDS * 32 / FILTER_BITS_PER_KEY;
+  uint64_t min_blocks = (capacity - 1) / keys_per_block + 1;
+  uint64_t num_blocks = 1;
+
+  while (num_blocks < min_blocks) {
+    num_blocks *= 2;
+  }
+
+  if (num_blocks > SIZE_MAX / (FILTER_BLOCK_WORDS * sizeof(uint32_t))) {
+    DIE("%s\n", "Unable to allocate key filter");
+  }
+
+  filter->blocks = calloc(num_blocks * FILTER_BLOCK_WORDS, sizeof(uint32_t));
+  if (!filter->blocks) {
+    DIE("%s\n", "Unable to allocate key filter");
+  }
+
+  filter->block_mask = num_blocks - 1;
+  filter->capacity = capacity;
+  atomic_init(&filter->num_keys, 0);
+}
+
+void filter_destroy(KeyFilter* filter) {
+  free((void*)filter->blocks);
+  filter->blocks = NULL;
+}
+
+/**
+ * @brief Add a key, which may be checked or added by other threads at the
+ * same time. Bits that are already set are left alone rather than written.
+ */
+void filter_add(KeyFilter* filter, uint64_t key) {
+  uint64_t hash = filter_hash(key);
+  _Atomic uint32_t* block = filter_block(filter, key);
+
+  for (uint32_t i = 0; i < FILTER_BLOCK_WORDS; i++) {
+    uint32_t mask = 1u << (((uint32_t)hash * FILTER_SALTS[i]) >> 27);
+
+    if (!(atomic_load_explicit(&block[i], memory_order_relaxed) & mask)) {
+      atomic_fetch_or_explicit(&block[i], mask, memory_order_relaxed);
+    }
+  }
+
+  atomic_fetch_add_explicit(&filter->num_keys, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Add count keys to a filter no other thread is using yet, with plain
+ * loads and stores in place of atomic read-modify-writes.
+ */
+void filter_add_all(KeyFilter* filter, const uint64_t* keys, uint64_t count) {
+  for (uint64_t k = 0; k < count; k++) {
+    uint64_t hash = filter_hash(keys[k]);
+    _Atomic uint32_t* block = filter_block(filter, keys[k]);
+
+    for (uint32_t i = 0; i < FILTER_BLOCK_WORDS; i++) {
+      uint32_t mask = 1u << (((uint32_t)hash * FILTER_SALTS[i]) >> 27);
+      uint32_t word = atomic_load_explicit(&block[i], memory_order_relaxed);
+
+      atomic_store_explicit(&block[i], word | mask, memory_order_relaxed);
+    }
+  }
+
+  atomic_fetch_add_explicit(&filter->num_keys, count, memory_order_relaxed);
+}
+
+/**
+ * @brief Return false only if key was never added.
+ */
+bool filter_may_contain(KeyFilter* filter, uint64_t key) {
+  uint64_t hash = filter_hash(key);
+  _Atomic uint32_t* block = filter_block(filter, key);
+
+  for (uint32_t i = 0; i < FILTER_BLOCK_WORDS; i++) {
+    uint32_t mask = 1u << (((uint32_t)hash * FILTER_SALTS[i]) >> 27);
+
+    if (!(atomic_load_explicit(&block[i], memory_order_relaxed) & mask)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Whether more keys were added than the filter was sized for, so that
+ * false positives are growing more common and it is time to rebuild it.
+ */
+bool filter_full(KeyFilter* filter) {
+  return atomic_load_explicit(&filter->num_keys, memory_order_relaxed) >
+         filter->capacity;
+}
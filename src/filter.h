@@ -0,0 +1,56 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Filter bits set aside for each key it is sized for; even at capacity
+ * fewer than one lookup in 100 for an absent key is a false positive.
+ */
+#define FILTER_BITS_PER_KEY 16
+
+/**
+ * @brief Fewest keys a filter is sized for, however small the table.
+ */
+#define FILTER_MIN_KEYS 4096
+
+/**
+ * @brief Consecutive ids share a block in runs of 1 << FILTER_RUN_BITS, so
+ * that adding keys in id order, as appends and rebuilds do, stays in cache.
+ */
+#define FILTER_RUN_BITS 3
+
+/**
+ * @brief Words in a block; every key sets one bit in each word of its block.
+ */
+#define FILTER_BLOCK_WORDS 8
+
+/**
+ * @brief A split block Bloom filter over ids. A key maps to one 32-byte block,
+ * chosen by its run of ids, and sets a bit in each of its eight words, so a
+ * check touches a single cache line. Keys are never removed: a deleted id
+ * only costs a false positive until the filter is rebuilt. Bits are set
+ * atomically, so inserts may add keys while other threads check them.
+ */
+typedef struct {
+  _Atomic uint32_t* blocks;
+  uint64_t block_mask;         // number of blocks, a power of two, less one
+  uint64_t capacity;           // keys the filter was sized for
+  _Atomic uint64_t num_keys;   // keys added since it was built
+} KeyFilter;
+
+void filter_init(KeyFilter* filter, uint64_t num_keys);
+
+void filter_destroy(KeyFilter* filter);
+
+void filter_add(KeyFilter* filter, uint64_t key);
+
+void filter_add_all(KeyFilter* filter, const uint64_t* keys, uint64_t count);
+
+bool filter_may_contain(KeyFilter* filter, uint64_t key);
+
+bool filter_full(KeyFilter* filter);
+
+#endif /* FILTER_H */
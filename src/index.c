@@ -0,0 +1,553 @@
+#include "index.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "common.h"
+
+typedef struct {
+  uint64_t hash;
+  uint64_t id;
+} IndexEntry;
+
+/*
+Index nodes share the common header. After it come the indexed column, which
+only the root needs, and the number of entries (in a leaf) or keys (in an
+internal node). A leaf then links to the next leaf and holds its entries in
+order. An internal node holds its keys, each the largest entry under the child
+to its left, followed by its children; the last child is the right child.
+*/
+static const uint32_t INDEX_NODE_COLUMN_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_NODE_COLUMN_OFFSET = COMMON_NODE_HEADER_SIZE;
+static const uint32_t INDEX_NODE_COUNT_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_NODE_COUNT_OFFSET =
+    INDEX_NODE_COLUMN_OFFSET + INDEX_NODE_COLUMN_SIZE;
+static const uint32_t INDEX_NODE_HEADER_SIZE =
+    COMMON_NODE_HEADER_SIZE + INDEX_NODE_COLUMN_SIZE + INDEX_NODE_COUNT_SIZE;
+
+static const uint32_t INDEX_LEAF_NEXT_LEAF_SIZE = sizeof(uint32_t);
+static const uint32_t INDEX_LEAF_NEXT_LEAF_OFFSET = INDEX_NODE_HEADER_SIZE;
+// rounded up so that the entries' 64-bit fields are aligned
+static const uint32_t INDEX_LEAF_ENTRIES_OFFSET =
+    (INDEX_LEAF_NEXT_LEAF_OFFSET + INDEX_LEAF_NEXT_LEAF_SIZE +
+     alignof(IndexEntry) - 1) /
+    alignof(IndexEntry) * alignof(IndexEntry);
+
+static const uint32_t INDEX_INTERNAL_KEYS_OFFSET = INDEX_NODE_HEADER_SIZE;
+
+// How many entries and keys fit depends on the database's page size
+static uint32_t index_leaf_max_entries(Pager* pager) {
+  return (pager->page_size - INDEX_LEAF_ENTRIES_OFFSET) / sizeof(IndexEntry);
+}
+
+static uint32_t index_internal_max_keys(Pager* pager) {
+  return (pager->page_size - INDEX_NODE_HEADER_SIZE - sizeof(uint32_t)) /
+         (sizeof(IndexEntry) + sizeof(uint32_t));
+}
+
+static uint32_t* index_node_column(void* node) {
+  return node + INDEX_NODE_COLUMN_OFFSET;
+}
+
+static uint32_t* index_node_count(void* node) {
+  return node + INDEX_NODE_COUNT_OFFSET;
+}
+
+static uint32_t* index_leaf_next_leaf(void* node) {
+  return node + INDEX_LEAF_NEXT_LEAF_OFFSET;
+}
+
+static IndexEntry* index_leaf_entries(void* node) {
+  return node + INDEX_LEAF_ENTRIES_OFFSET;
+}
+
+static IndexEntry* index_internal_keys(void* node) {
+  return node + INDEX_INTERNAL_KEYS_OFFSET;
+}
+
+static uint32_t* index_internal_children(Pager* pager, void* node) {
+  return node + INDEX_INTERNAL_KEYS_OFFSET +
+         index_internal_max_keys(pager) * sizeof(IndexEntry);
+}
+
+static void index_leaf_init(void* node) {
+  set_node_type(node, NODE_INDEX_LEAF);
+  set_root_node(node, false);
+  *index_node_count(node) = 0;
+  *index_leaf_next_leaf(node) = 0;
+}
+
+static void index_internal_init(void* node) {
+  set_node_type(node, NODE_INDEX_INTERNAL);
+  set_root_node(node, false);
+  *index_node_count(node) = 0;
+}
+
+// FNV-1a
+static uint64_t index_hash(const char* value) {
+  uint64_t hash = 14695981039346656037u;
+
+  for (; *value; value++) {
+    hash = (hash ^ (uint8_t)*value) * 1099511628211u;
+  }
+
+  return hash;
+}
+
+static int index_entry_compare(IndexEntry a, IndexEntry b) {
+  if (a.hash != b.hash) {
+    return a.hash < b.hash ? -1 : 1;
+  }
+
+  return (a.id > b.id) - (a.id < b.id);
+}
+
+static int index_entry_sort(const void* a, const void* b) {
+  return index_entry_compare(*(IndexEntry*)a, *(IndexEntry*)b);
+}
+
+/**
+ * @brief Return the index of the first of count sorted entries that is not
+ * less than entry, or count if there is none.
+ */
+static uint32_t index_entry_search(IndexEntry* entries, uint32_t count,
+                                   IndexEntry entry) {
+  uint32_t lo = 0;
+  uint32_t hi = count;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (index_entry_compare(entries[mid], entry) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static uint32_t index_child_for(Pager* pager, void* node, IndexEntry entry) {
+  uint32_t idx = index_entry_search(index_internal_keys(node),
+                                    *index_node_count(node), entry);
+
+  return index_internal_children(pager, node)[idx];
+}
+
+bool table_has_indexes(Table* table) {
+  for (uint32_t i = 0; i < COLUMN_COUNT; i++) {
+    if (table->index_roots[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief Find the table's indexes by following the list of roots that starts
+ * at the table root.
+ */
+void index_open(Table* table) {
+  Pager* pager = table->pager;
+  void* root = get_page(pager, table->root_page_num);
+  uint32_t page_num = *get_next_index(root);
+
+  memset(table->index_roots, 0, sizeof(table->index_roots));
+
+  while (page_num) {
+    void* node = get_page(pager, page_num);
+    table->index_roots[*index_node_column(node)] = page_num;
+    page_num = *get_next_index(node);
+  }
+}
+
+/**
+ * @brief Add an entry to a full leaf by splitting it, filling in the split
+ * key and new right sibling. An entry past the end of the rightmost leaf
+ * starts a leaf of its own, so entries added in order pack leaves full.
+ */
+static void index_leaf_split(Pager* pager, uint32_t page_num, uint32_t idx,
+                             IndexEntry entry, IndexEntry* split_key,
+                             uint32_t* split_page) {
+  IndexEntry all[index_leaf_max_entries(pager) + 1];
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  void* node = get_page(pager, page_num);
+  uint32_t count = *index_node_count(node);
+  IndexEntry* entries = index_leaf_entries(node);
+
+  memcpy(all, entries, idx * sizeof(IndexEntry));
+  all[idx] = entry;
+  memcpy(all + idx + 1, entries + idx, (count - idx) * sizeof(IndexEntry));
+
+  uint32_t left = (count + 1) / 2;
+  if (idx == count && *index_leaf_next_leaf(node) == 0) {
+    left = count;
+  }
+
+  index_leaf_init(new_node);
+  *index_node_count(new_node) = count + 1 - left;
+  memcpy(index_leaf_entries(new_node), all + left,
+         (count + 1 - left) * sizeof(IndexEntry));
+  *index_leaf_next_leaf(new_node) = *index_leaf_next_leaf(node);
+
+  *index_node_count(node) = left;
+  memcpy(entries, all, left * sizeof(IndexEntry));
+  *index_leaf_next_leaf(node) = new_page_num;
+
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, new_page_num);
+
+  *split_key = all[left - 1];
+  *split_page = new_page_num;
+}
+
+/**
+ * @brief Add a child, and the key bounding the child to its left, after child
+ * idx of an internal node, splitting the node if it is full: the middle key
+ * moves up, filling in the split key and new right sibling.
+ */
+static bool index_internal_add(Pager* pager, uint32_t page_num, uint32_t idx,
+                               IndexEntry key, uint32_t child,
+                               IndexEntry* split_key, uint32_t* split_page) {
+  void* node = get_page(pager, page_num);
+  uint32_t count = *index_node_count(node);
+  IndexEntry* keys = index_internal_keys(node);
+  uint32_t* children = index_internal_children(pager, node);
+  uint32_t max_keys = index_internal_max_keys(pager);
+
+  if (count < max_keys) {
+    memmove(keys + idx + 1, keys + idx, (count - idx) * sizeof(IndexEntry));
+    memmove(children + idx + 2, children + idx + 1,
+            (count - idx) * sizeof(uint32_t));
+    keys[idx] = key;
+    children[idx + 1] = child;
+    *index_node_count(node) = count + 1;
+    pager_mark_dirty(pager, page_num);
+    return false;
+  }
+
+  IndexEntry all_keys[max_keys + 1];
+  uint32_t all_children[max_keys + 2];
+
+  memcpy(all_keys, keys, idx * sizeof(IndexEntry));
+  all_keys[idx] = key;
+  memcpy(all_keys + idx + 1, keys + idx, (count - idx) * sizeof(IndexEntry));
+  memcpy(all_children, children, (idx + 1) * sizeof(uint32_t));
+  all_children[idx + 1] = child;
+  memcpy(all_children + idx + 2, children + idx + 1,
+         (count - idx) * sizeof(uint32_t));
+
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  node = get_page(pager, page_num);
+
+  // count + 1 keys: left keeps the first half, the next moves up
+  uint32_t left = (count + 1) / 2;
+  uint32_t right = count - left;
+
+  index_internal_init(new_node);
+  *index_node_count(new_node) = right;
+  memcpy(index_internal_keys(new_node), all_keys + left + 1,
+         right * sizeof(IndexEntry));
+  memcpy(index_internal_children(pager, new_node), all_children + left + 1,
+         (right + 1) * sizeof(uint32_t));
+
+  *index_node_count(node) = left;
+  memcpy(index_internal_keys(node), all_keys, left * sizeof(IndexEntry));
+  memcpy(index_internal_children(pager, node), all_children,
+         (left + 1) * sizeof(uint32_t));
+
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, new_page_num);
+
+  *split_key = all_keys[left];
+  *split_page = new_page_num;
+  return true;
+}
+
+/**
+ * @brief Add an entry under a node. Returns true if the node split, with the
+ * largest entry left in it as split_key and its new right sibling as
+ * split_page, which the caller adds to the parent.
+ */
+static bool index_node_insert(Pager* pager, uint32_t page_num,
+                              IndexEntry entry, IndexEntry* split_key,
+                              uint32_t* split_page) {
+  void* node = get_page(pager, page_num);
+  uint32_t count = *index_node_count(node);
+
+  if (get_node_type(node) == NODE_INDEX_LEAF) {
+    IndexEntry* entries = index_leaf_entries(node);
+    uint32_t idx = index_entry_search(entries, count, entry);
+
+    if (count == index_leaf_max_entries(pager)) {
+      index_leaf_split(pager, page_num, idx, entry, split_key, split_page);
+      return true;
+    }
+
+    memmove(entries + idx + 1, entries + idx,
+            (count - idx) * sizeof(IndexEntry));
+    entries[idx] = entry;
+    *index_node_count(node) = count + 1;
+    pager_mark_dirty(pager, page_num);
+    return false;
+  }
+
+  uint32_t idx =
+      index_entry_search(index_internal_keys(node), count, entry);
+  uint32_t child = index_internal_children(pager, node)[idx];
+  IndexEntry child_key;
+  uint32_t child_split;
+
+  if (!index_node_insert(pager, child, entry, &child_key, &child_split)) {
+    return false;
+  }
+
+  return index_internal_add(pager, page_num, idx, child_key, child_split,
+                            split_key, split_page);
+}
+
+/**
+ * @brief Add an entry to an index. When the root splits it stays on its page:
+ * its contents move to a new left child under a fresh internal root.
+ */
+static void index_insert(Pager* pager, uint32_t root_page_num,
+                         IndexEntry entry) {
+  IndexEntry split_key;
+  uint32_t split_page;
+
+  if (!index_node_insert(pager, root_page_num, entry, &split_key,
+                         &split_page)) {
+    return;
+  }
+
+  uint32_t left_page_num = get_unused_page_num(pager);
+  void* left = get_page(pager, left_page_num);
+  void* root = get_page(pager, root_page_num);
+  uint32_t column = *index_node_column(root);
+  uint32_t next_index = *get_next_index(root);
+
+  memcpy(left, root, pager->page_size);
+  set_root_node(left, false);
+  *get_next_index(left) = 0;
+
+  index_internal_init(root);
+  set_root_node(root, true);
+  *index_node_column(root) = column;
+  *get_next_index(root) = next_index;
+  *index_node_count(root) = 1;
+  index_internal_keys(root)[0] = split_key;
+  index_internal_children(pager, root)[0] = left_page_num;
+  index_internal_children(pager, root)[1] = split_page;
+
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, root_page_num);
+}
+
+/**
+ * @brief Index the column of every row in the table, unless it already is.
+ * The caller holds the table latched exclusively. Entries are sorted before
+ * they are added, so the leaves fill one after another.
+ */
+bool index_create(Table* table, Column column) {
+  if (table->index_roots[column]) {
+    return false;
+  }
+
+  Pager* pager = table->pager;
+  uint32_t page_num = get_unused_page_num(pager);
+  void* node = get_page(pager, page_num);
+  void* root = get_page(pager, table->root_page_num);
+
+  index_leaf_init(node);
+  set_root_node(node, true);
+  *index_node_column(node) = column;
+  *get_next_index(node) = *get_next_index(root);
+  *get_next_index(root) = page_num;
+  pager_mark_dirty(pager, page_num);
+  pager_mark_dirty(pager, table->root_page_num);
+
+  size_t capacity = 1024;
+  size_t count = 0;
+  IndexEntry* entries = malloc(capacity * sizeof(IndexEntry));
+  Cursor cursor;
+  Row row;
+
+  cursor_start_init(table, &cursor);
+
+  while (!(cursor.end)) {
+    if (count == capacity) {
+      capacity *= 2;
+      entries = capacity <= SIZE_MAX / sizeof(IndexEntry)
+                    ? realloc(entries, capacity * sizeof(IndexEntry))
+                    : NULL;
+    }
+
+    if (!entries) {
+      DIE("%s\n", "Unable to allocate index entries");
+    }
+
+    deserialize_row(cursor_value(&cursor), &row);
+    entries[count].hash = index_hash(row_column(&row, column));
+    entries[count].id = row.id;
+    count++;
+    cursor_advance(&cursor);
+  }
+
+  cursor_close(&cursor);
+  qsort(entries, count, sizeof(IndexEntry), index_entry_sort);
+
+  for (size_t i = 0; i < count; i++) {
+    index_insert(pager, page_num, entries[i]);
+  }
+
+  free(entries);
+  table->index_roots[column] = page_num;
+  return true;
+}
+
+void index_insert_row(Table* table, Row* row) {
+  for (uint32_t column = 0; column < COLUMN_COUNT; column++) {
+    if (table->index_roots[column]) {
+      IndexEntry entry = {index_hash(row_column(row, column)), row->id};
+      index_insert(table->pager, table->index_roots[column], entry);
+    }
+  }
+}
+
+void index_delete_row(Table* table, Row* row) {
+  Pager* pager = table->pager;
+
+  for (uint32_t column = 0; column < COLUMN_COUNT; column++) {
+    uint32_t page_num = table->index_roots[column];
+    if (!page_num) {
+      continue;
+    }
+
+    IndexEntry entry = {index_hash(row_column(row, column)), row->id};
+    void* node = get_page(pager, page_num);
+
+    while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+      page_num = index_child_for(pager, node, entry);
+      node = get_page(pager, page_num);
+    }
+
+    uint32_t count = *index_node_count(node);
+    IndexEntry* entries = index_leaf_entries(node);
+    uint32_t idx = index_entry_search(entries, count, entry);
+
+    if (idx < count && index_entry_compare(entries[idx], entry) == 0) {
+      memmove(entries + idx, entries + idx + 1,
+              (count - idx - 1) * sizeof(IndexEntry));
+      *index_node_count(node) = count - 1;
+      pager_mark_dirty(pager, page_num);
+    }
+  }
+}
+
+/**
+ * @brief Collect the ids filed under hash in the column's index, in order,
+ * from the leaf where the first of them would be onward. Returns false, with
+ * no ids, if the column has no index.
+ */
+static bool index_find_ids(Table* table, Column column, uint64_t hash,
+                           Arena* arena, uint64_t** ids, size_t* num_ids) {
+  Pager* pager = table->pager;
+  IndexEntry first = {hash, 0};
+  size_t capacity = 16;
+  size_t count = 0;
+
+  table_lock(table, LATCH_SHARED);
+
+  uint32_t page_num = table->index_roots[column];
+  if (!page_num) {
+    table_unlock(table);
+    return false;
+  }
+
+  *ids = arena_alloc(arena, capacity * sizeof(uint64_t));
+  void* node = pager_pin(pager, page_num);
+
+  while (get_node_type(node) == NODE_INDEX_INTERNAL) {
+    uint32_t child = index_child_for(pager, node, first);
+    pager_unpin(pager, node);
+    node = pager_pin(pager, child);
+  }
+
+  uint32_t idx =
+      index_entry_search(index_leaf_entries(node), *index_node_count(node),
+                         first);
+
+  while (1) {
+    IndexEntry* entries = index_leaf_entries(node);
+    uint32_t num_entries = *index_node_count(node);
+
+    for (; idx < num_entries && entries[idx].hash == hash; idx++) {
+      if (count == capacity) {
+        *ids = arena_grow(arena, *ids, capacity * sizeof(uint64_t),
+                          capacity * 2 * sizeof(uint64_t));
+        capacity *= 2;
+      }
+
+      (*ids)[count++] = entries[idx].id;
+    }
+
+    uint32_t next = *index_leaf_next_leaf(node);
+    if (idx < num_entries || next == 0) {
+      break;
+    }
+
+    pager_unpin(pager, node);
+    node = pager_pin(pager, next);
+    idx = 0;
+  }
+
+  pager_unpin(pager, node);
+  table_unlock(table);
+  *num_ids = count;
+  return true;
+}
+
+/**
+ * @brief Visit the rows whose column holds value, in id order, through the
+ * column's index. Returns false, having visited nothing, if the column has no
+ * index.
+ */
+bool index_lookup(Table* table, Column column, const char* value,
+                  Arena* arena, ScanVisitor visit, void* state) {
+  uint64_t* ids;
+  size_t count;
+  Row row;
+
+  if (!index_find_ids(table, column, index_hash(value), arena, &ids,
+                      &count)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    Cursor cursor;
+    table_scan(table, ids[i], &cursor);
+
+    bool found = !(cursor.end) &&
+                 *leaf_node_key(cursor_node(&cursor), cursor.cell_num) ==
+                     ids[i];
+
+    if (found) {
+      deserialize_row(cursor_value(&cursor), &row);
+    }
+
+    cursor_close(&cursor);
+
+    // a row of another value that hashes alike, or one deleted meanwhile
+    if (found && strcmp(row_column(&row, column), value) == 0) {
+      visit(state, &row);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "pager.h"
+#include "scan.h"
+
+/*
+A secondary index maps the values of a text column to ids. It is a B+tree of
+its own in the database file whose entries pair the hash of a row's value with
+the row's id, ordered by both, so an index fits hundreds of entries in a page
+whatever the length of the values. A lookup gathers the ids filed under the
+hash of a value and reads each row to weed out collisions.
+
+Index nodes are only changed with the table latched exclusively, so readers
+holding it shared need only pin them. Deletes remove entries without merging
+the leaves they leave sparse.
+*/
+
+bool table_has_indexes(Table* table);
+
+void index_open(Table* table);
+
+bool index_create(Table* table, Column column);
+
+void index_insert_row(Table* table, Row* row);
+
+void index_delete_row(Table* table, Row* row);
+
+bool index_lookup(Table* table, Column column, const char* value,
+                  Arena* arena, ScanVisitor visit, void* state);
+
+#endif /* INDEX_H */
@@ -2,11 +2,18 @@
 
 #include "io.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 
+static char input_block[INPUT_BLOCK_SIZE];
+static size_t input_start = 0;
+static size_t input_end = 0;
+
 StringBuffer* string_buffer_init(void) {
   StringBuffer* buffer = malloc(sizeof(StringBuffer));
   buffer->buffer = NULL;
@@ -21,15 +28,75 @@ void string_buffer_destroy(StringBuffer* buffer) {
   free(buffer);
 }
 
-void string_buffer_read(StringBuffer* buffer) {
+static bool input_fill(void) {
   ssize_t bytes;
 
-  if ((bytes = getline(&(buffer->buffer), &(buffer->len), stdin)) <= 0) {
-    DIE("%s\n", "Error reading input");
+  do {
+    bytes = read(STDIN_FILENO, input_block, INPUT_BLOCK_SIZE);
+  } while (bytes == -1 && errno == EINTR);
+
+  if (bytes == -1) {
+    DIE("Error reading input: %d\n", errno);
   }
 
-  buffer->input_l = bytes - 1;
-  buffer->buffer[bytes - 1] = '\0';
+  input_start = 0;
+  input_end = bytes;
+  return bytes > 0;
 }
 
-void print_prompt(void) { printf("%s > ", APP_NAME); }
+/**
+ * @brief Read the next line of input into the buffer, without its newline.
+ * Return false once input is exhausted.
+ */
+bool string_buffer_read(StringBuffer* buffer) {
+  size_t len = 0;
+
+  while (1) {
+    if (input_start == input_end && !input_fill()) {
+      if (len == 0) {
+        return false;
+      }
+      break;
+    }
+
+    char* start = input_block + input_start;
+    char* newline = memchr(start, '\n', input_end - input_start);
+    size_t n = newline ? (size_t)(newline - start) : input_end - input_start;
+
+    if (len + n + 1 > buffer->len) {
+      buffer->len = len + n + 1;
+      buffer->buffer = realloc(buffer->buffer, buffer->len);
+    }
+
+    memcpy(buffer->buffer + len, start, n);
+    len += n;
+    input_start += n;
+
+    if (newline) {
+      input_start++;
+      break;
+    }
+  }
+
+  buffer->input_l = len;
+  buffer->buffer[len] = '\0';
+  return true;
+}
+
+/**
+ * @brief Report whether more input is ready to be read without blocking.
+ */
+bool input_pending(void) {
+  if (input_start < input_end) {
+    return true;
+  }
+
+  struct pollfd fd = {.fd = STDIN_FILENO, .events = POLLIN};
+
+  return poll(&fd, 1, 0) > 0 && (fd.revents & POLLIN);
+}
+
+void print_prompt(void) {
+  printf("%s > ", APP_NAME);
+  fflush(stdout);
+}
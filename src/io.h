@@ -1,8 +1,15 @@
 #ifndef REPL_H
 #define REPL_H
 
+#include <stdbool.h>
 #include <unistd.h>
 
+/**
+ * @brief Bytes of standard input read at a time; lines are split out of the
+ * block in memory rather than fetched one read at a time.
+ */
+#define INPUT_BLOCK_SIZE (1 << 20)
+
 typedef struct {
   char *buffer;
   size_t len;
@@ -13,7 +20,9 @@ StringBuffer *string_buffer_init(void);
 
 void string_buffer_destroy(StringBuffer *ib);
 
-void string_buffer_read(StringBuffer *ib);
+bool string_buffer_read(StringBuffer *ib);
+
+bool input_pending(void);
 
 void print_prompt(void);
 
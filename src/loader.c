@@ -0,0 +1,620 @@
+#define _GNU_SOURCE
+
+#include "loader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "common.h"
+#include "index.h"
+#include "preparator.h"
+
+typedef struct {
+  FILE* file;
+  char* line;
+  size_t len;
+  uint64_t line_num;
+} LoaderInput;
+
+typedef struct {
+  uint32_t page_num;  // 0 until the node's first child arrives
+  uint32_t count;
+  uint32_t* children;
+  uint64_t* keys;
+} LoaderNode;
+
+typedef struct {
+  LoaderNode open;  // node being filled
+  LoaderNode held;  // previous full node, written once its successor exists
+  bool has_held;
+  bool written;  // a node on this level was written; it is not the root
+} LoaderLevel;
+
+typedef struct {
+  Table* table;
+  bool bulk;  // building an empty table bottom-up; else plain inserts
+  uint32_t leaf_fill;  // bytes of each leaf to fill
+  uint32_t fanout;
+
+  void* leaf;               // scratch copy of the leaf being filled
+  uint32_t prev_leaf_page;  // last leaf written, 0 if none
+  LoaderLevel* levels[LOADER_MAX_LEVELS];  // levels[0] sits above the leaves
+
+  bool has_last_key;
+  uint64_t last_key;
+  LoadStats* stats;
+} Loader;
+
+typedef struct {
+  FILE* file;
+  Row row;
+} LoaderRun;
+
+/**
+ * @brief Read and parse the next non-blank line.
+ * Return false at end of input; otherwise result holds the parse outcome.
+ */
+static bool loader_read_row(LoaderInput* input, Row* row,
+                            PrepareResult* result) {
+  ssize_t bytes;
+
+  while ((bytes = getline(&input->line, &input->len, input->file)) != -1) {
+    input->line_num++;
+
+    while (bytes > 0 &&
+           (input->line[bytes - 1] == '\n' || input->line[bytes - 1] == '\r')) {
+      input->line[--bytes] = '\0';
+    }
+
+    if (strspn(input->line, " \t") == (size_t)bytes) {
+      continue;
+    }
+
+    *result = prepare_row(input->line, row);
+    return true;
+  }
+
+  return false;
+}
+
+static uint32_t loader_alloc_page(Loader* loader) {
+  Pager* pager = loader->table->pager;
+  uint32_t page_num = get_unused_page_num(pager);
+
+  get_page(pager, page_num);
+  return page_num;
+}
+
+static void loader_node_init(LoaderNode* node, uint32_t fanout) {
+  node->page_num = 0;
+  node->count = 0;
+  node->children = malloc(fanout * sizeof(uint32_t));
+  node->keys = malloc(fanout * sizeof(uint64_t));
+}
+
+static LoaderLevel* loader_level(Loader* loader, uint32_t level_num) {
+  if (level_num >= LOADER_MAX_LEVELS) {
+    DIE("Bulk load exceeded %d tree levels\n", LOADER_MAX_LEVELS);
+  }
+
+  if (!loader->levels[level_num]) {
+    LoaderLevel* level = malloc(sizeof(LoaderLevel));
+    loader_node_init(&level->open, loader->fanout);
+    loader_node_init(&level->held, loader->fanout);
+    level->has_held = false;
+    level->written = false;
+
+    loader->levels[level_num] = level;
+  }
+
+  return loader->levels[level_num];
+}
+
+/**
+ * @brief Return the page of the node on the given level that the next child
+ * will be added to, reserving it if this is the node's first child.
+ */
+static uint32_t loader_parent(Loader* loader, uint32_t level_num) {
+  LoaderLevel* level = loader_level(loader, level_num);
+
+  if (!level->open.page_num) {
+    level->open.page_num = loader_alloc_page(loader);
+  }
+
+  return level->open.page_num;
+}
+
+static void loader_set_parent(Pager* pager, uint32_t page_num,
+                              uint32_t parent_page_num) {
+  void* node = get_page(pager, page_num);
+
+  *get_parent_node(node) = parent_page_num;
+  pager_mark_dirty(pager, page_num);
+}
+
+static void loader_push(Loader* loader, uint32_t level_num, uint32_t child,
+                        uint64_t key);
+
+static void loader_write_node(Loader* loader, uint32_t level_num,
+                              LoaderNode* node) {
+  Pager* pager = loader->table->pager;
+  uint32_t parent_page_num = loader_parent(loader, level_num + 1);
+
+  void* page = get_page(pager, node->page_num);
+  internal_node_init(page);
+  *get_parent_node(page) = parent_page_num;
+  internal_node_fill(pager, page, node->children, node->keys, node->count);
+  pager_mark_dirty(pager, node->page_num);
+
+  loader->levels[level_num]->written = true;
+  loader_push(loader, level_num + 1, node->page_num,
+              node->keys[node->count - 1]);
+}
+
+/**
+ * @brief Add a finished child to the node being filled on the given level.
+ * A node that fills up is held back until the next one starts, so the last
+ * two nodes on a level can be evened out rather than leaving a runt.
+ */
+static void loader_push(Loader* loader, uint32_t level_num, uint32_t child,
+                        uint64_t key) {
+  LoaderLevel* level = loader_level(loader, level_num);
+  LoaderNode* open = &level->open;
+
+  open->children[open->count] = child;
+  open->keys[open->count++] = key;
+
+  if (open->count < loader->fanout) {
+    return;
+  }
+
+  if (level->has_held) {
+    loader_write_node(loader, level_num, &level->held);
+  }
+
+  LoaderNode spare = level->held;
+  level->held = level->open;
+  level->open = spare;
+  level->open.page_num = 0;
+  level->open.count = 0;
+  level->has_held = true;
+}
+
+/**
+ * @brief Move children from the held (full) node to the last node on a level
+ * so the two split their children evenly.
+ */
+static void loader_even_out(Loader* loader, LoaderLevel* level) {
+  LoaderNode* held = &level->held;
+  LoaderNode* open = &level->open;
+  uint32_t half = (held->count + open->count) / 2;
+
+  if (open->count >= half) {
+    return;
+  }
+
+  uint32_t move = half - open->count;
+
+  memmove(open->children + move, open->children,
+          open->count * sizeof(uint32_t));
+  memmove(open->keys + move, open->keys, open->count * sizeof(uint64_t));
+
+  for (uint32_t i = 0; i < move; i++) {
+    open->children[i] = held->children[held->count - move + i];
+    open->keys[i] = held->keys[held->count - move + i];
+  }
+
+  held->count -= move;
+  open->count += move;
+
+  for (uint32_t i = 0; i < move; i++) {
+    loader_set_parent(loader->table->pager, open->children[i], open->page_num);
+  }
+}
+
+/**
+ * @brief Write the scratch leaf out. It becomes the root only if it is the
+ * sole leaf; otherwise it is linked after the previous leaf and added to its
+ * parent.
+ */
+static void loader_write_leaf(Loader* loader, bool more) {
+  Pager* pager = loader->table->pager;
+  bool is_root = !more && loader->prev_leaf_page == 0;
+  uint32_t page_num = loader->table->root_page_num;
+  uint32_t parent_page_num = 0;
+  uint32_t next_index = 0;
+
+  if (!is_root) {
+    parent_page_num = loader_parent(loader, 0);
+    page_num = loader_alloc_page(loader);
+  }
+
+  void* node = get_page(pager, page_num);
+  if (is_root) {
+    next_index = *get_next_index(node);
+  }
+
+  memcpy(node, loader->leaf, pager->page_size);
+  set_root_node(node, is_root);
+  *get_parent_node(node) = parent_page_num;
+  *get_next_index(node) = next_index;
+  pager_mark_dirty(pager, page_num);
+
+  if (loader->prev_leaf_page) {
+    void* prev = get_page(pager, loader->prev_leaf_page);
+    *leaf_node_next_leaf(prev) = page_num;
+    pager_mark_dirty(pager, loader->prev_leaf_page);
+  }
+
+  loader->prev_leaf_page = page_num;
+
+  if (!is_root) {
+    uint32_t num_cells = *leaf_node_num_cells(loader->leaf);
+    loader_push(loader, 0, page_num,
+                *leaf_node_key(loader->leaf, num_cells - 1));
+  }
+
+  leaf_node_init(pager, loader->leaf);
+}
+
+static void loader_write_root(Loader* loader, LoaderNode* node) {
+  Pager* pager = loader->table->pager;
+  uint32_t root_page_num = loader->table->root_page_num;
+
+  void* root = get_page(pager, root_page_num);
+  internal_node_init(root);
+  set_root_node(root, true);
+  internal_node_fill(pager, root, node->children, node->keys, node->count);
+  pager_mark_dirty(pager, root_page_num);
+
+  for (uint32_t i = 0; i < node->count; i++) {
+    loader_set_parent(pager, node->children[i], root_page_num);
+  }
+
+  // the page reserved for this node was never written; the root page is used
+  if (node->page_num) {
+    pager_free_page(pager, node->page_num);
+  }
+}
+
+/**
+ * @brief Flush the last leaf and close out each level bottom-up until one
+ * holds a single node, which is written to the root page.
+ */
+static void loader_finish(Loader* loader) {
+  if (*leaf_node_num_cells(loader->leaf) > 0) {
+    loader_write_leaf(loader, false);
+  }
+
+  for (uint32_t h = 0; h < LOADER_MAX_LEVELS && loader->levels[h]; h++) {
+    LoaderLevel* level = loader->levels[h];
+
+    if (!level->written && !(level->has_held && level->open.count > 0)) {
+      loader_write_root(loader,
+                        level->has_held ? &level->held : &level->open);
+      break;
+    }
+
+    if (level->has_held) {
+      if (level->open.count > 0) {
+        loader_even_out(loader, level);
+      }
+
+      loader_write_node(loader, h, &level->held);
+      level->has_held = false;
+    }
+
+    if (level->open.count > 0) {
+      loader_write_node(loader, h, &level->open);
+    }
+  }
+}
+
+static void loader_add(Loader* loader, Row* row) {
+  // input arrives sorted, so a repeated id is always the previous one
+  if (loader->has_last_key && row->id == loader->last_key) {
+    loader->stats->duplicates++;
+    return;
+  }
+
+  loader->has_last_key = true;
+  loader->last_key = row->id;
+
+  if (!loader->bulk) {
+    if (table_insert(loader->table, row)) {
+      loader->stats->rows++;
+    } else {
+      loader->stats->duplicates++;
+    }
+
+    return;
+  }
+
+  Pager* pager = loader->table->pager;
+  void* leaf = loader->leaf;
+  uint32_t used =
+      leaf_node_space_for_cells(pager) - leaf_node_free_bytes(leaf);
+  uint32_t needed = LEAF_NODE_SLOT_SIZE + row_size(row);
+
+  if (*leaf_node_num_cells(leaf) > 0 &&
+      (used + needed > loader->leaf_fill || !leaf_node_fits(leaf, row))) {
+    loader_write_leaf(loader, true);
+  }
+
+  leaf_node_put(pager, loader->leaf, *leaf_node_num_cells(loader->leaf),
+                row->id, row);
+  filter_add(&loader->table->filter, row->id);
+  atomic_fetch_add_explicit(&pager->num_rows, 1, memory_order_relaxed);
+
+  loader->stats->rows++;
+}
+
+static int row_id_cmp(const void* a, const void* b) {
+  uint64_t ia = ((Row*)a)->id;
+  uint64_t ib = ((Row*)b)->id;
+
+  return (ia > ib) - (ia < ib);
+}
+
+static void loader_heap_sift_down(LoaderRun* heap, uint32_t n, uint32_t i) {
+  while (1) {
+    uint32_t smallest = i;
+    uint32_t left = 2 * i + 1;
+    uint32_t right = left + 1;
+
+    if (left < n && heap[left].row.id < heap[smallest].row.id) {
+      smallest = left;
+    }
+
+    if (right < n && heap[right].row.id < heap[smallest].row.id) {
+      smallest = right;
+    }
+
+    if (smallest == i) {
+      return;
+    }
+
+    LoaderRun tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+/**
+ * @brief K-way merge of sorted runs, feeding rows to the loader in id order.
+ */
+static void loader_merge(Loader* loader, FILE** runs, uint32_t num_runs) {
+  LoaderRun* heap = malloc(num_runs * sizeof(LoaderRun));
+  uint32_t n = 0;
+
+  for (uint32_t i = 0; i < num_runs; i++) {
+    if (fread(&heap[n].row, sizeof(Row), 1, runs[i]) == 1) {
+      heap[n++].file = runs[i];
+    }
+  }
+
+  for (uint32_t i = n / 2; i-- > 0;) {
+    loader_heap_sift_down(heap, n, i);
+  }
+
+  while (n > 0) {
+    loader_add(loader, &heap[0].row);
+
+    if (fread(&heap[0].row, sizeof(Row), 1, heap[0].file) != 1) {
+      heap[0] = heap[--n];
+    }
+
+    loader_heap_sift_down(heap, n, 0);
+  }
+
+  for (uint32_t i = 0; i < num_runs; i++) {
+    fclose(runs[i]);
+  }
+
+  free(heap);
+}
+
+/**
+ * @brief External merge sort: sort the input in memory-sized chunks, spill
+ * each to a temporary run file, and merge the runs. Input that fits in one
+ * chunk never touches disk.
+ */
+static void loader_sort_and_add(Loader* loader, LoaderInput* input) {
+  Row* rows = malloc(LOADER_RUN_ROWS * sizeof(Row));
+  FILE** runs = NULL;
+  uint32_t num_runs = 0;
+  PrepareResult result;
+
+  while (1) {
+    uint32_t n = 0;
+    while (n < LOADER_RUN_ROWS && loader_read_row(input, &rows[n], &result)) {
+      n++;
+    }
+
+    if (n == 0) {
+      break;
+    }
+
+    qsort(rows, n, sizeof(Row), row_id_cmp);
+
+    if (num_runs == 0 && n < LOADER_RUN_ROWS) {
+      for (uint32_t i = 0; i < n; i++) {
+        loader_add(loader, &rows[i]);
+      }
+
+      free(rows);
+      return;
+    }
+
+    FILE* run = tmpfile();
+    if (!run || fwrite(rows, sizeof(Row), n, run) != n) {
+      DIE("%s\n", "Error writing sort run");
+    }
+
+    rewind(run);
+    runs = realloc(runs, (num_runs + 1) * sizeof(FILE*));
+    runs[num_runs++] = run;
+
+    if (n < LOADER_RUN_ROWS) {
+      break;
+    }
+  }
+
+  free(rows);
+  loader_merge(loader, runs, num_runs);
+  free(runs);
+}
+
+/**
+ * @brief Validate every line up front so a bad file is rejected before the
+ * table is touched, noting whether ids already arrive in ascending order.
+ */
+static LoadResult loader_scan(LoaderInput* input, bool* sorted,
+                              LoadStats* stats) {
+  Row row;
+  PrepareResult result;
+  bool has_prev = false;
+  uint64_t prev = 0;
+
+  *sorted = true;
+
+  while (loader_read_row(input, &row, &result)) {
+    if (result != PREPARE_SUCCESS) {
+      stats->line = input->line_num;
+      return LOAD_SYNTAX_ERROR;
+    }
+
+    if (has_prev && row.id <= prev) {
+      *sorted = false;
+    }
+
+    prev = row.id;
+    has_prev = true;
+  }
+
+  return LOAD_SUCCESS;
+}
+
+static bool table_is_empty(Table* table) {
+  void* root = get_page(table->pager, table->root_page_num);
+
+  return get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+}
+
+/**
+ * @brief Load "id username email" rows from a file.
+ * An empty table is built bottom-up: rows are sorted (externally if need be),
+ * packed into leaves at fill_percent, and internal levels are assembled as the
+ * leaves are written, all in one sequential pass. A table that already holds
+ * rows, or has indexes to keep up, gets ordinary inserts in key order instead.
+ * Repeated ids are skipped.
+ */
+LoadResult bulk_load(Table* table, const char* filename, uint32_t fill_percent,
+                     LoadStats* stats) {
+  stats->rows = 0;
+  stats->duplicates = 0;
+  stats->line = 0;
+
+  LoaderInput input = {
+      .file = fopen(filename, "r"),
+      .line = NULL,
+      .len = 0,
+      .line_num = 0,
+  };
+
+  if (!input.file) {
+    return LOAD_FILE_ERROR;
+  }
+
+  bool sorted;
+  LoadResult result = loader_scan(&input, &sorted, stats);
+
+  if (result != LOAD_SUCCESS) {
+    free(input.line);
+    fclose(input.file);
+    return result;
+  }
+
+  uint64_t num_lines = input.line_num;
+  rewind(input.file);
+  input.line_num = 0;
+
+  Pager* pager = table->pager;
+  bool own_transaction = !pager->in_transaction;
+
+  // Building the tree bottom-up needs it to ourselves until it is done
+  table_lock(table, LATCH_EXCLUSIVE);
+
+  Loader loader = {
+      .table = table,
+      .bulk = own_transaction && table_is_empty(table) &&
+              !table_has_indexes(table),
+      .leaf_fill = leaf_node_space_for_cells(pager) * fill_percent / 100,
+      .fanout = (internal_node_max_cells(pager) + 1) * fill_percent / 100,
+      .leaf = malloc(pager->page_size),
+      .prev_leaf_page = 0,
+      .levels = {NULL},
+      .has_last_key = false,
+      .last_key = 0,
+      .stats = stats,
+  };
+
+  // evening out the last two nodes needs three children to share
+  if (loader.fanout < 3) {
+    loader.fanout = 3;
+  }
+
+  leaf_node_init(pager, loader.leaf);
+
+  if (loader.bulk) {
+    // the table is empty, so its filter is sized afresh for the rows to come
+    filter_destroy(&table->filter);
+    filter_init(&table->filter, num_lines);
+    pager_begin_unlogged(pager);
+  } else {
+    // plain inserts latch the table themselves
+    table_unlock(table);
+
+    if (own_transaction) {
+      pager_begin(pager);
+    }
+  }
+
+  if (sorted) {
+    Row row;
+    PrepareResult parsed;
+
+    while (loader_read_row(&input, &row, &parsed)) {
+      loader_add(&loader, &row);
+    }
+  } else {
+    loader_sort_and_add(&loader, &input);
+  }
+
+  if (loader.bulk) {
+    loader_finish(&loader);
+    pager_end_unlogged(pager);
+    table_unlock(table);
+  }
+
+  if (own_transaction) {
+    pager_commit(pager);
+  }
+
+  for (uint32_t h = 0; h < LOADER_MAX_LEVELS && loader.levels[h]; h++) {
+    free(loader.levels[h]->open.children);
+    free(loader.levels[h]->open.keys);
+    free(loader.levels[h]->held.children);
+    free(loader.levels[h]->held.keys);
+    free(loader.levels[h]);
+  }
+
+  free(loader.leaf);
+  free(input.line);
+  fclose(input.file);
+
+  return LOAD_SUCCESS;
+}
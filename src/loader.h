@@ -0,0 +1,39 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "pager.h"
+
+/**
+ * @brief Default share of each page the bulk loader fills, in percent.
+ * Leaving some room spares the first few later inserts a split.
+ */
+#define LOADER_FILL_PERCENT 90
+
+/**
+ * @brief Rows sorted in memory at a time; larger inputs are spilled to
+ * sorted runs on disk and merged.
+ */
+#define LOADER_RUN_ROWS (1 << 16)
+
+/**
+ * @brief Upper bound on tree height while building; a fanout of two or more
+ * cannot exceed it with 32-bit page numbers.
+ */
+#define LOADER_MAX_LEVELS 32
+
+typedef enum {
+  LOAD_SUCCESS,
+  LOAD_FILE_ERROR,
+  LOAD_SYNTAX_ERROR,
+} LoadResult;
+
+typedef struct {
+  uint64_t rows;        // rows added to the table
+  uint64_t duplicates;  // rows skipped because their id was already present
+  uint64_t line;        // line of the first syntax error
+} LoadStats;
+
+LoadResult bulk_load(Table* table, const char* filename, uint32_t fill_percent,
+                     LoadStats* stats);
+
+#endif /* LOADER_H */
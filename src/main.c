@@ -1,39 +1,136 @@
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "executor.h"
 #include "io.h"
 #include "metacommand.h"
 #include "preparator.h"
+#include "scan.h"
+
+static const struct option long_options[] = {
+    {"batch", no_argument, NULL, 'b'},
+    {"cache-pages", required_argument, NULL, 'c'},
+    {"interactive", no_argument, NULL, 'i'},
+    {"mmap", no_argument, NULL, 'm'},
+    {"no-wal", no_argument, NULL, 'n'},
+    {"threads", required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0},
+};
+
+static void usage(void) {
+  DIE("Usage: %s [--batch | --interactive] [--cache-pages N] [--mmap] "
+      "[--no-wal] [--threads N] <database>\n",
+      APP_NAME);
+}
+
+/**
+ * @brief Parse a count given to an option, or print the usage message if it
+ * is not a plain decimal number that fits in 32 bits.
+ */
+static uint32_t parse_count(const char* arg) {
+  char* end;
+
+  errno = 0;
+  unsigned long long value = strtoull(arg, &end, 10);
+
+  if (!isdigit((unsigned char)arg[0]) || *end != '\0' || errno == ERANGE ||
+      value > UINT32_MAX) {
+    usage();
+  }
+
+  return (uint32_t)value;
+}
 
 int main(int argc, char* argv[]) {
-  if (argc < 2) {
+  PagerOptions options = {
+      .mode = PAGER_MODE_BUFFERED,
+      .num_frames = PAGER_DEFAULT_FRAMES,
+      .wal = true,
+  };
+  // Prompts and acknowledgements are only for a person at a terminal
+  bool batch = !isatty(STDIN_FILENO);
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "bc:imnt:", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+      case 'b':
+        batch = true;
+        break;
+      case 'c':
+        options.num_frames = parse_count(optarg);
+        break;
+      case 'i':
+        batch = false;
+        break;
+      case 'm':
+        options.mode = PAGER_MODE_MMAP;
+        break;
+      case 'n':
+        options.wal = false;
+        break;
+      case 't':
+        scan_set_threads(parse_count(optarg));
+        break;
+      default:
+        usage();
+    }
+  }
+
+  if (optind >= argc) {
     DIE("%s\n", "Must provide a database filename");
   }
 
-  char* filename = argv[1];
-  Table* table = db_open(filename);
+  char* filename = argv[optind];
+  Table* table = db_open(filename, &options);
 
   StringBuffer* buffer = string_buffer_init();
+  Statement statement = {.rows = NULL, .num_rows = 0, .rows_capacity = 0};
+  uint32_t executed = 0;
+  uint32_t failed = 0;
 
   while (1) {
-    print_prompt();
-    string_buffer_read(buffer);
+    // Group commit: everything committed while input kept arriving
+    // is made durable together, right before we would block for more.
+    if (!input_pending()) {
+      pager_sync(table->pager);
+    }
+
+    if (!batch) {
+      print_prompt();
+    }
+
+    if (!string_buffer_read(buffer)) {
+      break;
+    }
 
     if (buffer->buffer[0] == '.') {
-      switch (process_meta_command(buffer, table)) {
-        case META_COMMAND_SUCCESS:
-          continue;
-        case META_COMMAND_UNRECOGNIZED:
-          fprintf(stderr, "Unrecognized command '%s'\n", buffer->buffer);
-          continue;
+      MetaCommandResult result = process_meta_command(buffer, table);
+
+      if (result == META_COMMAND_EXIT) {
+        break;
       }
+
+      if (result == META_COMMAND_UNRECOGNIZED) {
+        fprintf(stderr, "Unrecognized command '%s'\n", buffer->buffer);
+        failed++;
+      }
+
+      continue;
     }
 
-    Statement statement;
+    PrepareResult prepared = prepare_statement(buffer, &statement);
 
-    switch (prepare_statement(buffer, &statement)) {
+    if (prepared != PREPARE_SUCCESS) {
+      failed++;
+    }
+
+    switch (prepared) {
       case PREPARE_SUCCESS:
         break;
       case PREPARE_SYNTAX_ERROR:
@@ -49,14 +146,33 @@ int main(int argc, char* argv[]) {
       case PREPARE_NEGATIVE_ID:
         fprintf(stderr, "%s\n", "Provided negative id");
         continue;
+      case PREPARE_ID_OUT_OF_RANGE:
+        fprintf(stderr, "%s\n", "Provided id is out of range");
+        continue;
       default:
         fprintf(stderr, "%s\n",
                 "[main::PrepareStatement] An error occurred (TODO:)");
     }
 
-    switch (execute_statement(&statement, table)) {
+    ExecutionResult result = execute_statement(&statement, table);
+
+    if (result == EXECUTE_SUCCESS) {
+      executed++;
+    } else {
+      failed++;
+    }
+
+    switch (result) {
       case EXECUTE_SUCCESS:
-        fprintf(stdout, "%s\n", "Executed statement");
+        if (!batch) {
+          // A write is acknowledged only once it is durable; the sync takes
+          // every commit still pending along with it
+          pager_sync(table->pager);
+          fprintf(stdout, "%s\n", "Executed statement");
+        }
+        if (statement.type == STATEMENT_INSERT && statement.duplicates) {
+          fprintf(stderr, "Skipped %u duplicate keys\n", statement.duplicates);
+        }
         break;
 
       case EXECUTE_TABLE_FULL:
@@ -66,7 +182,34 @@ int main(int argc, char* argv[]) {
       case EXECUTE_DUPLICATE_KEY:
         fprintf(stderr, "%s\n", "Duplicate key");
         break;
+
+      case EXECUTE_TRANSACTION_OPEN:
+        fprintf(stderr, "%s\n", "Transaction already open");
+        break;
+
+      case EXECUTE_NO_TRANSACTION:
+        fprintf(stderr, "%s\n", "No transaction open");
+        break;
+
+      case EXECUTE_INDEX_EXISTS:
+        fprintf(stderr, "%s\n", "Index already exists");
+        break;
+
+      case EXECUTE_SUM_OVERFLOW:
+        fprintf(stderr, "%s\n", "Sum out of range");
+        break;
     }
   }
+
+  if (batch) {
+    // the whole batch is reported on once its last commits are durable
+    pager_sync(table->pager);
+    fprintf(stderr, "Executed %u statements, %u failed\n", executed, failed);
+  }
+
+  free(statement.rows);
+  arena_destroy(&statement.arena);
+  string_buffer_destroy(buffer);
+  db_close(table);
   return EXIT_SUCCESS;
 }
@@ -1,22 +1,196 @@
 #include "metacommand.h"
 
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "btree.h"
+#include "loader.h"
+#include "output.h"
+
+static MetaCommandResult meta_import(char* args, Table* table) {
+  char* filename = strtok(args, " ");
+  char* fill_str = strtok(NULL, " ");
+  char* end = "";
+  long fill_percent =
+      fill_str ? strtol(fill_str, &end, 10) : LOADER_FILL_PERCENT;
+
+  if (!filename || *end != '\0' || end == fill_str || fill_percent < 1 ||
+      fill_percent > 100 || strtok(NULL, " ")) {
+    fprintf(stderr, "%s\n", "Usage: .import <file> [fill percent]");
+    return META_COMMAND_SUCCESS;
+  }
+
+  LoadStats stats;
+  switch (bulk_load(table, filename, fill_percent, &stats)) {
+    case LOAD_SUCCESS:
+      pager_sync(table->pager);
+      printf("Imported %" PRIu64 " rows\n", stats.rows);
+      if (stats.duplicates) {
+        fprintf(stderr, "Skipped %" PRIu64 " duplicate keys\n",
+                stats.duplicates);
+      }
+      break;
+    case LOAD_FILE_ERROR:
+      fprintf(stderr, "Unable to open '%s'\n", filename);
+      break;
+    case LOAD_SYNTAX_ERROR:
+      fprintf(stderr, "Syntax error on line %" PRIu64 " of '%s'\n",
+              stats.line, filename);
+      break;
+  }
+
+  return META_COMMAND_SUCCESS;
+}
+
+static MetaCommandResult meta_mode(char* args) {
+  char* name = strtok(args, " ");
+  OutputMode mode;
+
+  if (!name || strtok(NULL, " ") || !output_parse_mode(name, &mode)) {
+    fprintf(stderr, "%s\n", "Usage: .mode text|csv|tsv|binary");
+    return META_COMMAND_SUCCESS;
+  }
+
+  output_set_mode(mode);
+  return META_COMMAND_SUCCESS;
+}
+
+static MetaCommandResult meta_stats(char* args, Table* table) {
+  char* format = strtok(args, " ");
+  bool json = format && strcmp(format, "json") == 0;
+
+  if ((format && !json && strcmp(format, "text") != 0) || strtok(NULL, " ")) {
+    fprintf(stderr, "%s\n", "Usage: .stats [text|json]");
+    return META_COMMAND_SUCCESS;
+  }
+
+  PagerStats pager;
+  pager_stats(table->pager, &pager);
+
+  const char* names[] = {
+      "pager_hits",     "pager_misses",  "pager_evictions", "bytes_read",
+      "bytes_written",  "syscalls",      "btree_descents",  "leaf_splits",
+      "internal_splits", "cells_shifted",
+  };
+  uint64_t values[] = {
+      pager.hits,
+      pager.misses,
+      pager.evictions,
+      pager.bytes_read,
+      pager.bytes_written,
+      pager.syscalls,
+      atomic_load_explicit(&table->stats.descents, memory_order_relaxed),
+      atomic_load_explicit(&table->stats.leaf_splits, memory_order_relaxed),
+      atomic_load_explicit(&table->stats.internal_splits,
+                           memory_order_relaxed),
+      atomic_load_explicit(&table->stats.cells_shifted, memory_order_relaxed),
+  };
+  uint32_t count = sizeof(values) / sizeof(values[0]);
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (json) {
+      printf("%s\"%s\": %llu", i ? ", " : "{", names[i],
+             (unsigned long long)values[i]);
+    } else {
+      printf("%s %llu\n", names[i], (unsigned long long)values[i]);
+    }
+  }
+
+  if (json) {
+    printf("}\n");
+  }
+
+  return META_COMMAND_SUCCESS;
+}
+
+static MetaCommandResult meta_btree(Table* table) {
+  TreeShape shape;
+  table_shape(table, &shape);
+
+  printf("height %u\n", shape.height);
+  for (uint32_t i = 0; i < shape.height; i++) {
+    printf("level %u pages %u\n", i, shape.level_pages[i]);
+  }
+
+  uint32_t leaves = shape.level_pages[shape.height - 1];
+  printf("leaf fill %.1f%%\n", 100.0 * shape.leaf_bytes_used / leaves /
+                                   leaf_node_space_for_cells(table->pager));
+
+  return META_COMMAND_SUCCESS;
+}
+
+/**
+ * @brief Print the database's format and the pager's configuration, or with
+ * "page_size N" re-create an empty database with pages of that size.
+ */
+static MetaCommandResult meta_settings(char* args, Table* table) {
+  char* name = strtok(args, " ");
+  char* value = strtok(NULL, " ");
+
+  if (name) {
+    char* end = NULL;
+    unsigned long page_size = value ? strtoul(value, &end, 10) : 0;
+
+    if (strcmp(name, "page_size") != 0 || !value || *end != '\0' ||
+        strtok(NULL, " ") || page_size > UINT32_MAX ||
+        !page_size_valid(page_size)) {
+      fprintf(stderr, "%s\n",
+              "Usage: .settings [page_size 4096|8192|16384|32768|65536]");
+    } else if (table->pager->in_transaction) {
+      fprintf(stderr, "%s\n", "Transaction already open");
+    } else if (!db_set_page_size(table, page_size)) {
+      fprintf(stderr, "%s\n",
+              "Page size can only be changed on an empty database");
+    }
+
+    return META_COMMAND_SUCCESS;
+  }
+
+  Pager* pager = table->pager;
+
+  printf("format_version %u\n", DB_FORMAT_VERSION);
+  printf("page_size %u\n", pager->page_size);
+  printf("pages %u\n", pager->num_pages);
+  printf("rows %" PRIu64 "\n",
+         atomic_load_explicit(&pager->num_rows, memory_order_relaxed));
+  printf("mode %s\n", pager->mode == PAGER_MODE_MMAP ? "mmap" : "buffered");
+  if (pager->mode == PAGER_MODE_BUFFERED) {
+    printf("cache_pages %u\n", pager->num_frames);
+  }
+  printf("wal %s\n", pager->wal ? "on" : "off");
+
+  return META_COMMAND_SUCCESS;
+}
+
 MetaCommandResult process_meta_command(StringBuffer* buffer, Table* table) {
   if (strcmp(buffer->buffer, ".exit") == 0) {
-    db_close(table);
-    exit(EXIT_SUCCESS);
+    return META_COMMAND_EXIT;
+  }
+
+  if (strncmp(buffer->buffer, ".import", 7) == 0 &&
+      (buffer->buffer[7] == ' ' || buffer->buffer[7] == '\0')) {
+    return meta_import(buffer->buffer + 7, table);
+  }
+
+  if (strncmp(buffer->buffer, ".mode", 5) == 0 &&
+      (buffer->buffer[5] == ' ' || buffer->buffer[5] == '\0')) {
+    return meta_mode(buffer->buffer + 5);
+  }
+
+  if (strncmp(buffer->buffer, ".stats", 6) == 0 &&
+      (buffer->buffer[6] == ' ' || buffer->buffer[6] == '\0')) {
+    return meta_stats(buffer->buffer + 6, table);
   }
 
   if (strcmp(buffer->buffer, ".btree") == 0) {
-    printf("TODO\n");
-    return META_COMMAND_SUCCESS;
+    return meta_btree(table);
   }
 
-  if (strcmp(buffer->buffer, ".settings") == 0) {
-    printf("TODO\n");
-    return META_COMMAND_SUCCESS;
+  if (strncmp(buffer->buffer, ".settings", 9) == 0 &&
+      (buffer->buffer[9] == ' ' || buffer->buffer[9] == '\0')) {
+    return meta_settings(buffer->buffer + 9, table);
   }
 
   return META_COMMAND_UNRECOGNIZED;
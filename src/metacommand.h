@@ -7,6 +7,7 @@
 typedef enum {
   META_COMMAND_SUCCESS,
   META_COMMAND_UNRECOGNIZED,
+  META_COMMAND_EXIT,
 } MetaCommandResult;
 
 MetaCommandResult process_meta_command(StringBuffer* ib, Table* table);
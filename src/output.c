@@ -0,0 +1,390 @@
+#include "output.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+
+// Worst case for one formatted row: every character of each text column
+// escaped to two, plus the id, quotes and separators
+static const uint32_t OUTPUT_ROW_MAX =
+    2 * (COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE) + 32;
+
+static const char* const OUTPUT_MODE_NAMES[] = {
+    [OUTPUT_MODE_TEXT] = "text",
+    [OUTPUT_MODE_CSV] = "csv",
+    [OUTPUT_MODE_TSV] = "tsv",
+    [OUTPUT_MODE_BINARY] = "binary",
+};
+
+struct OutputChunk {
+  OutputChunk* next;
+  uint32_t len;
+  char data[OUTPUT_BUFFER_SIZE];
+};
+
+static OutputMode output_mode = OUTPUT_MODE_TEXT;
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static uint32_t output_len = 0;
+
+bool output_parse_mode(const char* name, OutputMode* mode) {
+  for (uint32_t i = 0; i < sizeof(OUTPUT_MODE_NAMES) / sizeof(char*); i++) {
+    if (strcmp(name, OUTPUT_MODE_NAMES[i]) == 0) {
+      *mode = i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void output_set_mode(OutputMode mode) { output_mode = mode; }
+
+/**
+ * @brief Write out the buffered rows. Anything printed through stdio so far
+ * (a prompt, say) goes first so the two streams stay in order.
+ */
+static void output_write(const char* data, uint32_t len) {
+  uint32_t written = 0;
+
+  while (written < len) {
+    ssize_t n = write(STDOUT_FILENO, data + written, len - written);
+
+    if (n == -1 && errno != EINTR) {
+      DIE("Error writing output: %d\n", errno);
+    }
+
+    if (n > 0) {
+      written += n;
+    }
+  }
+}
+
+void output_flush(void) {
+  fflush(stdout);
+  output_write(output_buffer, output_len);
+  output_len = 0;
+}
+
+static char* output_uint(char* out, uint64_t value) {
+  char digits[20];
+  uint32_t n = 0;
+
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  while (n) {
+    *out++ = digits[--n];
+  }
+
+  return out;
+}
+
+static char* output_str(char* out, const char* str) {
+  size_t len = strlen(str);
+
+  memcpy(out, str, len);
+  return out + len;
+}
+
+static char* output_csv_field(char* out, const char* str) {
+  if (!strpbrk(str, ",\"\r\n")) {
+    return output_str(out, str);
+  }
+
+  *out++ = '"';
+  for (; *str; str++) {
+    if (*str == '"') {
+      *out++ = '"';
+    }
+    *out++ = *str;
+  }
+  *out++ = '"';
+
+  return out;
+}
+
+static char* output_tsv_field(char* out, const char* str) {
+  for (; *str; str++) {
+    switch (*str) {
+      case '\t':
+        *out++ = '\\', *out++ = 't';
+        break;
+      case '\n':
+        *out++ = '\\', *out++ = 'n';
+        break;
+      case '\r':
+        *out++ = '\\', *out++ = 'r';
+        break;
+      case '\\':
+        *out++ = '\\', *out++ = '\\';
+        break;
+      default:
+        *out++ = *str;
+    }
+  }
+
+  return out;
+}
+
+static char* output_frame(char* out, uint32_t len) {
+  memcpy(out, &len, sizeof(len));
+  return out + sizeof(len);
+}
+
+/**
+ * @brief Format a row in the current mode at out, which has room for at least
+ * OUTPUT_ROW_MAX bytes. Returns the end of the row.
+ */
+static char* output_format(char* out, Row* row) {
+  switch (output_mode) {
+    case OUTPUT_MODE_TEXT:
+      *out++ = '(';
+      out = output_uint(out, row->id);
+      out = output_str(out, ", ");
+      out = output_str(out, row->username);
+      out = output_str(out, ", ");
+      out = output_str(out, row->email);
+      *out++ = ')';
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_CSV:
+      out = output_uint(out, row->id);
+      *out++ = ',';
+      out = output_csv_field(out, row->username);
+      *out++ = ',';
+      out = output_csv_field(out, row->email);
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_TSV:
+      out = output_uint(out, row->id);
+      *out++ = '\t';
+      out = output_tsv_field(out, row->username);
+      *out++ = '\t';
+      out = output_tsv_field(out, row->email);
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_BINARY:
+      out = output_frame(out, row_size(row));
+      out += serialize_row(row, out);
+      break;
+  }
+
+  return out;
+}
+
+/**
+ * @brief Format a row, writing the buffer out first if the row might not fit.
+ */
+void output_row(Row* row) {
+  if (output_len + OUTPUT_ROW_MAX > OUTPUT_BUFFER_SIZE) {
+    output_flush();
+  }
+
+  output_len = output_format(output_buffer + output_len, row) - output_buffer;
+}
+
+/**
+ * @brief Output the result of an aggregate, or its absence if value is NULL.
+ */
+void output_value(const uint64_t* value) {
+  if (output_len + OUTPUT_ROW_MAX > OUTPUT_BUFFER_SIZE) {
+    output_flush();
+  }
+
+  char* out = output_buffer + output_len;
+
+  switch (output_mode) {
+    case OUTPUT_MODE_TEXT:
+      *out++ = '(';
+      out = value ? output_uint(out, *value) : output_str(out, "NULL");
+      *out++ = ')';
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_CSV:
+      // an empty field
+      if (value) {
+        out = output_uint(out, *value);
+      }
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_TSV:
+      out = value ? output_uint(out, *value) : output_str(out, "\\N");
+      *out++ = '\n';
+      break;
+
+    case OUTPUT_MODE_BINARY:
+      if (value) {
+        out = output_frame(out, sizeof(*value));
+        memcpy(out, value, sizeof(*value));
+        out += sizeof(*value);
+      } else {
+        out = output_frame(out, UINT32_MAX);
+      }
+      break;
+  }
+
+  output_len = out - output_buffer;
+}
+
+void output_queue_init(OutputQueue* queue) {
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->ready, NULL);
+  pthread_cond_init(&queue->space, NULL);
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->current = NULL;
+  queue->num_chunks = 0;
+  queue->done = false;
+}
+
+// Hand the chunk being filled over to the draining thread
+static void output_queue_push(OutputQueue* queue) {
+  OutputChunk* chunk = queue->current;
+  if (!chunk) {
+    return;
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail) {
+    queue->tail->next = chunk;
+  } else {
+    queue->head = chunk;
+  }
+  queue->tail = chunk;
+  queue->num_chunks++;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+
+  queue->current = NULL;
+}
+
+/**
+ * @brief Format a row into the queue; called only by the queue's producer.
+ */
+void output_queue_row(OutputQueue* queue, Row* row) {
+  OutputChunk* chunk = queue->current;
+
+  if (chunk && chunk->len + OUTPUT_ROW_MAX > OUTPUT_BUFFER_SIZE) {
+    output_queue_push(queue);
+    chunk = NULL;
+  }
+
+  if (!chunk) {
+    chunk = malloc(sizeof(OutputChunk));
+    chunk->next = NULL;
+    chunk->len = 0;
+    queue->current = chunk;
+  }
+
+  chunk->len = output_format(chunk->data + chunk->len, row) - chunk->data;
+}
+
+/*
+The producer formats rows while it holds latches on the table, so it must not
+block there: a writer queued on the table would keep the threads ahead of it
+in the output from making progress, and with them the drain this producer is
+waiting on. Instead it checks output_queue_full where it holds no latches and
+only then waits, so that a queue never holds much more than
+OUTPUT_QUEUE_CHUNKS chunks and a large result set is not buffered whole.
+*/
+
+/**
+ * @brief Whether the queue holds as many chunks as it should before the
+ * drain catches up; called only by the queue's producer.
+ */
+bool output_queue_full(OutputQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  bool full = queue->num_chunks >= OUTPUT_QUEUE_CHUNKS;
+  pthread_mutex_unlock(&queue->lock);
+
+  return full;
+}
+
+/**
+ * @brief Wait until the queue has room for another chunk. The producer must
+ * hold no latches while it waits.
+ */
+void output_queue_wait(OutputQueue* queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->num_chunks >= OUTPUT_QUEUE_CHUNKS) {
+    pthread_cond_wait(&queue->space, &queue->lock);
+  }
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Mark the producer's rows complete, releasing output_queue_drain.
+ */
+void output_queue_close(OutputQueue* queue) {
+  output_queue_push(queue);
+
+  pthread_mutex_lock(&queue->lock);
+  queue->done = true;
+  pthread_cond_signal(&queue->ready);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * @brief Write out the queue's rows, after anything already buffered, as
+ * they arrive and until the producer closes it. The queue is then destroyed.
+ */
+void output_queue_drain(OutputQueue* queue) {
+  output_flush();
+
+  while (1) {
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->head && !queue->done) {
+      pthread_cond_wait(&queue->ready, &queue->lock);
+    }
+
+    OutputChunk* chunk = queue->head;
+    if (chunk) {
+      queue->head = chunk->next;
+      if (!queue->head) {
+        queue->tail = NULL;
+      }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    if (!chunk) {
+      break;
+    }
+
+    output_write(chunk->data, chunk->len);
+    free(chunk);
+
+    // room is only made once the chunk is written, so that at most
+    // OUTPUT_QUEUE_CHUNKS are waiting on the output at once
+    pthread_mutex_lock(&queue->lock);
+    queue->num_chunks--;
+    pthread_cond_signal(&queue->space);
+    pthread_mutex_unlock(&queue->lock);
+  }
+
+  pthread_cond_destroy(&queue->space);
+  pthread_cond_destroy(&queue->ready);
+  pthread_mutex_destroy(&queue->lock);
+}
+
+/**
+ * @brief Finish a result set: mark its end in binary mode and write out
+ * whatever is buffered.
+ */
+void output_end(void) {
+  if (output_mode == OUTPUT_MODE_BINARY) {
+    output_len = output_frame(output_buffer + output_len, 0) - output_buffer;
+  }
+
+  output_flush();
+}
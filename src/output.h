@@ -0,0 +1,82 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "pager.h"
+
+/**
+ * @brief Bytes of formatted rows collected before they are written out.
+ */
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+/**
+ * @brief How selected rows are written to stdout.
+ *
+ * Text prints "(id, username, email)". CSV quotes fields per RFC 4180 and TSV
+ * escapes tabs, newlines and backslashes, neither with a header line. Binary
+ * writes each row as a native-endian uint32_t length followed by that many
+ * bytes in the on-disk row format (see serialize_row), and ends each result
+ * with a zero length.
+ *
+ * An aggregate is written as a row of one column: "(42)" as text. In binary
+ * it is a length of 8 followed by a native-endian uint64_t, or a length of
+ * UINT32_MAX when there is no value, as for the min of no rows.
+ */
+typedef enum {
+  OUTPUT_MODE_TEXT,
+  OUTPUT_MODE_CSV,
+  OUTPUT_MODE_TSV,
+  OUTPUT_MODE_BINARY,
+} OutputMode;
+
+/**
+ * @brief Rows formatted on another thread, handed over in chunks of up to
+ * OUTPUT_BUFFER_SIZE bytes so that they can be written out while the rest
+ * are still being formatted.
+ */
+typedef struct OutputChunk OutputChunk;
+
+/**
+ * @brief Chunks a queue holds before output_queue_full asks its producer to
+ * wait for the drain to catch up.
+ */
+#define OUTPUT_QUEUE_CHUNKS 4
+
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;  // signalled when a chunk arrives or the queue closes
+  pthread_cond_t space;  // signalled when a chunk has been written out
+  OutputChunk* head;     // chunks ready to write, oldest first
+  OutputChunk* tail;
+  OutputChunk* current;  // chunk the producer is filling
+  uint32_t num_chunks;   // chunks ready to write
+  bool done;
+} OutputQueue;
+
+bool output_parse_mode(const char* name, OutputMode* mode);
+
+void output_set_mode(OutputMode mode);
+
+void output_row(Row* row);
+
+void output_value(const uint64_t* value);
+
+void output_end(void);
+
+void output_flush(void);
+
+void output_queue_init(OutputQueue* queue);
+
+void output_queue_row(OutputQueue* queue, Row* row);
+
+bool output_queue_full(OutputQueue* queue);
+
+void output_queue_wait(OutputQueue* queue);
+
+void output_queue_close(OutputQueue* queue);
+
+void output_queue_drain(OutputQueue* queue);
+
+#endif /* OUTPUT_H */
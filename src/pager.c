@@ -1,62 +1,348 @@
+#define _GNU_SOURCE
+
 #include "pager.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "btree.h"
 #include "common.h"
+#include "index.h"
 
-Table* db_open(const char* filename) {
-  Pager* pager = pager_open(filename);
-  Table* table = malloc(sizeof(Table));
+static void pager_drain(Pager* pager);
 
-  table->pager = pager;
-  table->root_page_num = 0;
+_Static_assert(sizeof(off_t) == sizeof(uint64_t),
+               "file offsets must be 64 bits to address large databases");
+
+static off_t pager_offset(Pager* pager, uint32_t page_num) {
+  return (off_t)page_num * pager->page_size;
+}
+
+bool page_size_valid(uint32_t page_size) {
+  return page_size >= PAGE_MIN_SIZE && page_size <= PAGE_MAX_SIZE &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+/**
+ * @brief Read the header of an existing database straight from the file,
+ * refusing a file that is not a database in the format this build writes
+ * before anything in it is taken for a node.
+ */
+static void pager_read_header(int fd, DbHeader* header) {
+  if (pread(fd, header, sizeof(DbHeader), 0) != sizeof(DbHeader) ||
+      header->magic != DB_MAGIC) {
+    DIE("%s\n", "Not a database, or one in format version 1 (32-bit ids)");
+  }
+
+  if (header->version != DB_FORMAT_VERSION) {
+    DIE("Database format version %u is not supported\n", header->version);
+  }
+
+  if (!page_size_valid(header->page_size)) {
+    DIE("Database page size %u is not supported\n", header->page_size);
+  }
+}
 
+/*
+The header's page and row counts change with nearly every statement, so the
+pager keeps them in memory and writes them to the header only when commits are
+made durable: a run of inserts dirties the header once per sync rather than
+once per row, and what reaches the disk always matches the pages committed
+with it. The free list head changes far less often and lives in the header.
+*/
+static void pager_write_header(Pager* pager) {
+  DbHeader* header = get_page(pager, 0);
+  uint64_t num_rows =
+      atomic_load_explicit(&pager->num_rows, memory_order_relaxed);
+
+  if (header->num_pages != pager->num_pages || header->num_rows != num_rows) {
+    header->num_pages = pager->num_pages;
+    header->num_rows = num_rows;
+    pager_mark_dirty(pager, 0);
+  }
+}
+
+/**
+ * @brief Lay out a new database: the header, then the root as an empty leaf.
+ * Both are written straight to the file, bypassing the log, so that a file
+ * with pages in it always starts with a header to size the pager by.
+ */
+static void db_init(Pager* pager) {
+  pager_begin_unlogged(pager);
+
+  DbHeader* header = get_page(pager, 0);
+  *header = (DbHeader){
+      .magic = DB_MAGIC,
+      .version = DB_FORMAT_VERSION,
+      .page_size = pager->page_size,
+      .root_page_num = PAGER_ROOT_PAGE_NUM,
+  };
+
+  void* root_node = get_page(pager, PAGER_ROOT_PAGE_NUM);
+  leaf_node_init(pager, root_node);
+  set_root_node(root_node, true);
+  pager_mark_dirty(pager, PAGER_ROOT_PAGE_NUM);
+
+  pager_write_header(pager);
+  pager_end_unlogged(pager);
+  pager_commit(pager);
+}
+
+/**
+ * @brief Bring a table up on a pager just opened: lay out a new database, or
+ * take the root and row count from an existing one's header.
+ */
+static void table_attach(Table* table, Pager* pager) {
   if (pager->num_pages == 0) {
-    // new file - initialize page 0 as leaf node
-    void* root_node = get_page(pager, 0);
-    leaf_node_init(root_node);
-    set_root_node(root_node, true);
+    db_init(pager);
   }
 
+  DbHeader* header = get_page(pager, 0);
+
+  table->pager = pager;
+  table->root_page_num = header->root_page_num;
+  atomic_store_explicit(&pager->num_rows, header->num_rows,
+                        memory_order_relaxed);
+  atomic_store_explicit(&table->last_leaf, table->root_page_num,
+                        memory_order_relaxed);
+
+  index_open(table);
+  table_build_filter(table);
+}
+
+Table* db_open(const char* filename, const PagerOptions* options) {
+  Pager* pager = pager_open(filename, options);
+  Table* table = malloc(sizeof(Table));
+
+  table->epoch = 0;
+  atomic_init(&table->stats.descents, 0);
+  atomic_init(&table->stats.leaf_splits, 0);
+  atomic_init(&table->stats.internal_splits, 0);
+  atomic_init(&table->stats.cells_shifted, 0);
+  atomic_init(&table->last_leaf, 0);
+
+  // As with frame latches, queue new readers behind a waiting writer
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&table->latch, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  table->filter.blocks = NULL;
+  table_attach(table, pager);
   return table;
 }
 
-void db_close(Table* table) {
-  Pager* pager = table->pager;
+static void pager_close(Pager* pager) {
+  if (pager->readahead) {
+    pager_drain(pager);
+    readahead_close(pager->readahead);
+  }
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (!pager->pages[i]) {
-      continue;
+  if (pager->wal && pager->in_transaction) {
+    // Abandon the open transaction. Its spilled frames were never committed,
+    // so recovery will ignore them on the next open.
+    wal_close(pager->wal, false);
+  } else if (pager->wal) {
+    pager_sync(pager);
+    pager_checkpoint(pager);
+    wal_close(pager->wal, true);
+  } else {
+    pager_sync(pager);
+    pager_flush_all(pager);
+  }
+
+  if (pager->mode == PAGER_MODE_MMAP) {
+    munmap(pager->map, PAGER_MMAP_RESERVE);
+
+    // drop the unused tail left by growing the file in large steps
+    if (ftruncate(pager->fd, pager_offset(pager, pager->num_pages)) == -1) {
+      DIE("Error truncating: %d\n", errno);
     }
 
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+    pager->stats.syscalls++;
   }
 
   if (close(pager->fd) == -1) {
     DIE("%s\n", "Error closing database file");
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void* page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
-    }
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    pthread_rwlock_destroy(&pager->frames[i].latch);
   }
 
+  pthread_mutex_destroy(&pager->lock);
+
+  free(pager->filename);
+  free(pager->frame_data);
+  free(pager->frames);
+  free(pager->buckets);
+  free(pager->dirty_frames);
+  free(pager->dirty_page_nums);
+  free(pager->dirty_pages);
   free(pager);
+}
+
+void db_close(Table* table) {
+  pager_close(table->pager);
+  pthread_rwlock_destroy(&table->latch);
+  filter_destroy(&table->filter);
   free(table);
 }
 
-Pager* pager_open(const char* filename) {
+/**
+ * @brief Re-create an empty database with pages of page_size bytes, keeping
+ * the pager's other options. Page size is fixed once rows are stored, so
+ * this returns false, changing nothing, if the table holds rows or indexes or
+ * a transaction is open.
+ */
+bool db_set_page_size(Table* table, uint32_t page_size) {
+  Pager* pager = table->pager;
+
+  if (atomic_load_explicit(&pager->num_rows, memory_order_relaxed) > 0 ||
+      table_has_indexes(table) || pager->in_transaction) {
+    return false;
+  }
+
+  PagerOptions options = {
+      .mode = pager->mode,
+      .num_frames = pager->num_frames,
+      .wal = pager->wal != NULL,
+      .page_size = page_size,
+  };
+  char* filename = strdup(pager->filename);
+
+  // the log is checkpointed and removed, so nothing of the old file remains
+  pager_close(pager);
+  if (truncate(filename, 0) == -1) {
+    DIE("Error truncating: %d\n", errno);
+  }
+
+  table_attach(table, pager_open(filename, &options));
+  free(filename);
+  return true;
+}
+
+void table_lock(Table* table, LatchMode mode) {
+  if (mode == LATCH_SHARED) {
+    pthread_rwlock_rdlock(&table->latch);
+  } else if (mode == LATCH_EXCLUSIVE) {
+    pthread_rwlock_wrlock(&table->latch);
+    table->epoch++;
+  }
+}
+
+void table_unlock(Table* table) { pthread_rwlock_unlock(&table->latch); }
+
+static void pager_pool_init(Pager* pager, uint32_t num_frames) {
+  if (num_frames < PAGER_MIN_FRAMES) {
+    num_frames = PAGER_MIN_FRAMES;
+  }
+
+  pager->num_frames = num_frames;
+  pager->frames = malloc(num_frames * sizeof(Frame));
+  pager->frame_data = malloc((size_t)num_frames * pager->page_size);
+  pager->dirty_frames = malloc((num_frames + 1) * sizeof(Frame*));
+  pager->dirty_page_nums = malloc((num_frames + 1) * sizeof(uint32_t));
+  pager->dirty_pages = malloc((num_frames + 1) * sizeof(void*));
+
+  if (!pager->frames || !pager->frame_data || !pager->dirty_frames ||
+      !pager->dirty_page_nums || !pager->dirty_pages) {
+    DIE("Unable to allocate buffer pool of %u pages\n", num_frames);
+  }
+
+  // A steady stream of readers must not lock an inserting writer out of a
+  // leaf, so waiting writers go first; no thread relatches a page it holds
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+  for (uint32_t i = 0; i < num_frames; i++) {
+    pager->frames[i].data = pager->frame_data + (size_t)i * pager->page_size;
+    pager->frames[i].pins = 0;
+    pthread_rwlock_init(&pager->frames[i].latch, &attr);
+  }
+
+  pthread_rwlockattr_destroy(&attr);
+
+  // Keep lookup chains short: at least two buckets per frame,
+  // rounded up to a power of two so we can mask instead of mod.
+  pager->num_buckets = 1;
+  while (pager->num_buckets < num_frames * 2) {
+    pager->num_buckets <<= 1;
+  }
+
+  pager->buckets = malloc(pager->num_buckets * sizeof(uint32_t));
+  for (uint32_t i = 0; i < pager->num_buckets; i++) {
+    pager->buckets[i] = PAGER_NO_FRAME;
+  }
+}
+
+/**
+ * @brief Map the file (and extend it by at least min_len bytes) at the end of
+ * the current mapping. The new range replaces part of the PROT_NONE
+ * reservation, so extant page pointers stay put.
+ */
+static void pager_mmap_extend(Pager* pager, size_t min_len) {
+  size_t new_len = pager->map_len * 2;
+
+  if (new_len < min_len) {
+    new_len = min_len;
+  }
+
+  if (new_len < PAGER_MMAP_MIN_GROWTH) {
+    new_len = PAGER_MMAP_MIN_GROWTH;
+  }
+
+  if (new_len > PAGER_MMAP_RESERVE) {
+    DIE("Database exceeds mmap reservation of %zu bytes\n",
+        PAGER_MMAP_RESERVE);
+  }
+
+  if (new_len > pager->file_len) {
+    if (ftruncate(pager->fd, (off_t)new_len) == -1) {
+      DIE("Error growing file: %d\n", errno);
+    }
+
+    pager->stats.syscalls++;
+  }
+
+  void* tail = mmap(pager->map + pager->map_len, new_len - pager->map_len,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, pager->fd,
+                    (off_t)pager->map_len);
+  if (tail == MAP_FAILED) {
+    DIE("Error mapping file: %d\n", errno);
+  }
+
+  pager->map_len = new_len;
+  if (new_len > pager->file_len) {
+    pager->file_len = new_len;
+  }
+}
+
+static void pager_mmap_init(Pager* pager) {
+  pager->map = mmap(NULL, PAGER_MMAP_RESERVE, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (pager->map == MAP_FAILED) {
+    DIE("Error reserving address space: %d\n", errno);
+  }
+
+  pager->map_len = 0;
+  if (pager->file_len > 0) {
+    pager_mmap_extend(pager, pager->file_len);
+  }
+}
+
+Pager* pager_open(const char* filename, const PagerOptions* options) {
   int fd;
 
   if ((fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR)) == -1) {
@@ -65,136 +351,1202 @@ Pager* pager_open(const char* filename) {
 
   off_t file_len = lseek(fd, 0, SEEK_END);
 
+  // an empty file is a new database, to be laid out by db_open
+  DbHeader header = {
+      .page_size = options->page_size ? options->page_size : PAGE_DEFAULT_SIZE,
+  };
+
+  if (file_len > 0) {
+    pager_read_header(fd, &header);
+  } else if (!page_size_valid(header.page_size)) {
+    DIE("Page size %u is not supported\n", header.page_size);
+  }
+
   Pager* pager = malloc(sizeof(Pager));
   pager->fd = fd;
+  pager->filename = strdup(filename);
+
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&pager->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
   pager->file_len = file_len;
-  pager->num_pages = (file_len / PAGE_SIZE);
+  pager->page_size = header.page_size;
+  pager->num_pages = header.num_pages;
+  atomic_init(&pager->num_rows, 0);
+  pager->mode = options->mode;
 
-  if (file_len % PAGE_SIZE != 0) {
+  if (file_len % pager->page_size != 0) {
     DIE("%s\n", "db file is corrupt");
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
+  pager->num_frames = 0;
+  pager->frames_used = 0;
+  pager->frames = NULL;
+  pager->frame_data = NULL;
+  pager->dirty_frames = NULL;
+  pager->dirty_page_nums = NULL;
+  pager->dirty_pages = NULL;
+  pager->num_buckets = 0;
+  pager->buckets = NULL;
+  pager->lru_head = PAGER_NO_FRAME;
+  pager->lru_tail = PAGER_NO_FRAME;
+  pager->map = NULL;
+  pager->map_len = 0;
+  pager->wal = NULL;
+  pager->in_transaction = false;
+  pager->unlogged = false;
+  pager->unlogged_from = 0;
+  pager->pending_commits = 0;
+  pager->readahead = NULL;
+  pager->cache_misses = 0;
+  pager->prefetch_stalls = 0;
+  pager->prefetch_wasted = 0;
+  memset(&pager->stats, 0, sizeof(PagerStats));
+  pager->stats.bytes_read = file_len > 0 ? sizeof(DbHeader) : 0;
+  pager->stats.syscalls = file_len > 0 ? 1 : 0;
+
+  switch (pager->mode) {
+    case PAGER_MODE_BUFFERED:
+      pager_pool_init(pager, options->num_frames);
+      pager->readahead = readahead_open(READAHEAD_RING_ENTRIES);
+      break;
+    case PAGER_MODE_MMAP:
+      pager_mmap_init(pager);
+      break;
+  }
+
+  if (pager->mode == PAGER_MODE_BUFFERED && options->wal) {
+    pager->wal = wal_open(filename, pager->page_size);
+
+    // Replay whatever a previous session committed but never checkpointed
+    if (pager->wal->committed_frames > 0) {
+      if (pager->wal->db_num_pages > pager->num_pages) {
+        pager->num_pages = pager->wal->db_num_pages;
+      }
+
+      pager_checkpoint(pager);
+    }
   }
 
   return pager;
 }
 
-void* get_page(Pager* pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    DIE("Attempted to fetch page number beyond range: %d > %d\n", page_num,
-        TABLE_MAX_PAGES);
+static uint32_t pager_bucket(Pager* pager, uint32_t page_num) {
+  // Fibonacci hashing; sequential page numbers spread across buckets
+  return (page_num * 2654435769u) & (pager->num_buckets - 1);
+}
+
+static uint32_t pager_lookup(Pager* pager, uint32_t page_num) {
+  uint32_t idx = pager->buckets[pager_bucket(pager, page_num)];
+
+  while (idx != PAGER_NO_FRAME && pager->frames[idx].page_num != page_num) {
+    idx = pager->frames[idx].hash_next;
   }
 
-  if (!pager->pages[page_num]) {
-    // cache miss; alloc and load from file
-    void* page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_len / PAGE_SIZE;
+  return idx;
+}
+
+static void pager_hash_remove(Pager* pager, uint32_t frame_idx) {
+  uint32_t* link = &pager->buckets[pager_bucket(
+      pager, pager->frames[frame_idx].page_num)];
 
-    // save partial page at end of file
-    if (pager->file_len % PAGE_SIZE) {
-      num_pages++;
-    }
+  while (*link != frame_idx) {
+    link = &pager->frames[*link].hash_next;
+  }
 
-    if (page_num <= num_pages) {
-      lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET);
+  *link = pager->frames[frame_idx].hash_next;
+}
 
-      if (read(pager->fd, page, PAGE_SIZE) == -1) {
-        DIE("Error reading file: %d\n", errno);
-      }
-    }
+static void pager_hash_insert(Pager* pager, uint32_t frame_idx) {
+  uint32_t bucket = pager_bucket(pager, pager->frames[frame_idx].page_num);
 
-    pager->pages[page_num] = page;
+  pager->frames[frame_idx].hash_next = pager->buckets[bucket];
+  pager->buckets[bucket] = frame_idx;
+}
 
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
-    }
+static void pager_lru_unlink(Pager* pager, uint32_t frame_idx) {
+  Frame* frame = &pager->frames[frame_idx];
+
+  if (frame->lru_prev != PAGER_NO_FRAME) {
+    pager->frames[frame->lru_prev].lru_next = frame->lru_next;
+  } else {
+    pager->lru_head = frame->lru_next;
   }
 
-  return pager->pages[page_num];
+  if (frame->lru_next != PAGER_NO_FRAME) {
+    pager->frames[frame->lru_next].lru_prev = frame->lru_prev;
+  } else {
+    pager->lru_tail = frame->lru_prev;
+  }
 }
 
-uint32_t get_unused_page_num(Pager* pager) { return pager->num_pages; }
+static void pager_lru_push_front(Pager* pager, uint32_t frame_idx) {
+  Frame* frame = &pager->frames[frame_idx];
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-  if (!pager->pages[page_num]) {
-    DIE("%s\n", "Attempted to flush null page");
+  frame->lru_prev = PAGER_NO_FRAME;
+  frame->lru_next = pager->lru_head;
+
+  if (pager->lru_head != PAGER_NO_FRAME) {
+    pager->frames[pager->lru_head].lru_prev = frame_idx;
+  } else {
+    pager->lru_tail = frame_idx;
   }
 
-  if (lseek(pager->fd, page_num * PAGE_SIZE, SEEK_SET) == -1) {
-    DIE("Error seeking: %d\n", errno);
+  pager->lru_head = frame_idx;
+}
+
+/**
+ * @brief Write a run of frames holding consecutive page numbers with a single
+ * pwritev, and mark them clean.
+ */
+static void pager_write_run(Pager* pager, Frame** run, uint32_t count) {
+  struct iovec iov[count];
+
+  for (uint32_t i = 0; i < count; i++) {
+    iov[i].iov_base = run[i]->data;
+    iov[i].iov_len = pager->page_size;
   }
 
-  if (write(pager->fd, pager->pages[page_num], PAGE_SIZE) == -1) {
+  off_t offset = pager_offset(pager, run[0]->page_num);
+  ssize_t expected = (ssize_t)count * pager->page_size;
+
+  if (pwritev(pager->fd, iov, count, offset) != expected) {
     DIE("Error writing: %d\n", errno);
   }
+
+  pager->stats.bytes_written += expected;
+  pager->stats.syscalls++;
+
+  for (uint32_t i = 0; i < count; i++) {
+    run[i]->dirty = false;
+  }
+
+  // Pages past the original end of file now live on disk;
+  // a later miss must read them back rather than zero-fill.
+  uint64_t end = pager_offset(pager, run[count - 1]->page_num + 1);
+  if (end > pager->file_len) {
+    pager->file_len = end;
+  }
 }
 
-void serialize_row(Row* src, void* dest) {
-  memcpy(dest + ID_OFFSET, &(src->id), ID_SIZE);
-  strncpy(dest + USERNAME_OFFSET, src->username, USERNAME_SIZE);
-  strncpy(dest + EMAIL_OFFSET, src->email, EMAIL_SIZE);
+static int frame_page_num_cmp(const void* a, const void* b) {
+  uint32_t pa = (*(Frame**)a)->page_num;
+  uint32_t pb = (*(Frame**)b)->page_num;
+
+  return (pa > pb) - (pa < pb);
 }
 
-void deserialize_row(void* src, Row* dest) {
-  memcpy(&(dest->id), src + ID_OFFSET, ID_SIZE);
-  memcpy(&(dest->username), src + USERNAME_OFFSET, USERNAME_SIZE);
-  memcpy(&(dest->email), src + EMAIL_OFFSET, EMAIL_SIZE);
+/**
+ * @brief Write back a single dirty frame. With a log, the page goes to the log
+ * as an uncommitted frame so the database file never sees unsynced changes.
+ */
+static void pager_spill(Pager* pager, Frame* frame) {
+  if (!frame->dirty) {
+    return;
+  }
+
+  if (pager->wal &&
+      !(pager->unlogged && frame->page_num >= pager->unlogged_from)) {
+    wal_append(pager->wal, &frame->page_num, &frame->data, 1, 0);
+    frame->dirty = false;
+  } else {
+    pager_write_run(pager, &frame, 1);
+  }
 }
 
 /**
- * @brief Return the position of the lowest id (start of left-most leaf node)
+ * @brief Gather the dirty frames into out, ordered by page number.
  */
-Cursor* cursor_start_init(Table* table) {
-  Cursor* cursor = table_find_by_key(table, 0);
+static uint32_t pager_collect_dirty(Pager* pager, Frame** out) {
+  uint32_t num_dirty = 0;
 
-  void* node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
+  for (uint32_t i = 0; i < pager->frames_used; i++) {
+    if (pager->frames[i].dirty) {
+      out[num_dirty++] = &pager->frames[i];
+    }
+  }
 
-  cursor->end = (num_cells == 0);
+  qsort(out, num_dirty, sizeof(Frame*), frame_page_num_cmp);
 
-  return cursor;
+  return num_dirty;
 }
 
 /**
- * @brief Return the position of the given key.
- * If the key is not extant, return the position
- * where it should be inserted.
+ * @brief Wait for the next read-ahead to land and mark its frame readable.
  */
-Cursor* table_find_by_key(Table* table, uint32_t key) {
-  uint32_t root_page_num = table->root_page_num;
-  void* root_node = get_page(table->pager, root_page_num);
+static void pager_reap(Pager* pager) {
+  int32_t result;
+  uint32_t frame_idx = readahead_wait(pager->readahead, &result);
+  Frame* frame = &pager->frames[frame_idx];
 
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
+  if (result != (int32_t)pager->page_size) {
+    DIE("Error reading page %u: %d\n", frame->page_num, result);
   }
 
-  return internal_node_find(table, root_page_num, key);
+  pager->stats.bytes_read += pager->page_size;
+
+  frame->pending = false;
 }
 
-void* cursor_value(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* page = get_page(cursor->table->pager, page_num);
+/**
+ * @brief Reap read-aheads until the frame's has landed. Returns whether that
+ * meant blocking, rather than just collecting reads that had completed.
+ */
+static bool pager_await(Pager* pager, Frame* frame) {
+  bool blocked = false;
+
+  while (frame->pending) {
+    blocked |= !readahead_ready(pager->readahead);
+    pager_reap(pager);
+  }
 
-  return leaf_node_value(page, cursor->cell_num);
+  return blocked;
 }
 
-void cursor_advance(Cursor* cursor) {
-  uint32_t page_num = cursor->page_num;
-  void* node = get_page(cursor->table->pager, page_num);
+static void pager_drain(Pager* pager) {
+  while (pager->readahead->in_flight > 0) {
+    pager_reap(pager);
+  }
+}
 
-  cursor->cell_num++;
-  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-    // Check if the leaf node has a sibling.
-    // If extant, jump to it; else, end of table reached.
-    uint32_t next_page_num = *leaf_node_next_leaf(node);
-    if (next_page_num == 0) {
-      // node was right-most leaf
-      cursor->end = true;
-    } else {
-      cursor->page_num = next_page_num;
-      cursor->cell_num = 0;
+/**
+ * @brief Claim a frame for a page that is not resident, evicting the least
+ * recently used unpinned page (and writing it back) once the pool is full.
+ */
+static uint32_t pager_claim_frame(Pager* pager) {
+  if (pager->frames_used < pager->num_frames) {
+    return pager->frames_used++;
+  }
+
+  uint32_t victim = pager->lru_tail;
+  while (victim != PAGER_NO_FRAME && pager->frames[victim].pins > 0) {
+    victim = pager->frames[victim].lru_prev;
+  }
+
+  if (victim == PAGER_NO_FRAME) {
+    DIE("All %u buffer pool frames are latched\n", pager->num_frames);
+  }
+
+  Frame* frame = &pager->frames[victim];
+
+  // a read may still be landing in the victim's memory
+  pager_await(pager, frame);
+
+  if (frame->prefetched) {
+    pager->prefetch_wasted++;
+  }
+
+  pager->stats.evictions++;
+
+  pager_spill(pager, frame);
+
+  pager_hash_remove(pager, victim);
+  pager_lru_unlink(pager, victim);
+
+  return victim;
+}
+
+static Frame* pager_fetch(Pager* pager, uint32_t page_num);
+
+void* get_page(Pager* pager, uint32_t page_num) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    size_t end = ((size_t)page_num + 1) * pager->page_size;
+
+    if (end > pager->map_len) {
+      // new pages come from ftruncate and so are already zeroed
+      pager_mmap_extend(pager, end);
+    }
+
+    if (page_num >= pager->num_pages) {
+      pager->num_pages = page_num + 1;
+    }
+
+    return pager->map + (size_t)page_num * pager->page_size;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  void* data = pager_fetch(pager, page_num)->data;
+  pthread_mutex_unlock(&pager->lock);
+
+  return data;
+}
+
+/**
+ * @brief Find or load a page in the buffer pool; called with lock held.
+ */
+static Frame* pager_fetch(Pager* pager, uint32_t page_num) {
+  uint32_t frame_idx = pager_lookup(pager, page_num);
+
+  if (frame_idx != PAGER_NO_FRAME) {
+    // cache hit; promote to most recently used
+    if (pager->lru_head != frame_idx) {
+      pager_lru_unlink(pager, frame_idx);
+      pager_lru_push_front(pager, frame_idx);
+    }
+
+    Frame* frame = &pager->frames[frame_idx];
+    pager->stats.hits++;
+    if (pager_await(pager, frame)) {
+      pager->prefetch_stalls++;
+    }
+
+    frame->prefetched = false;
+    return frame;
+  }
+
+  // cache miss; claim a frame and load from file
+  pager->stats.misses++;
+  frame_idx = pager_claim_frame(pager);
+  Frame* frame = &pager->frames[frame_idx];
+  frame->page_num = page_num;
+  frame->pending = false;
+  frame->prefetched = false;
+
+  uint32_t wal_frame =
+      pager->wal ? wal_find_frame(pager->wal, page_num) : WAL_NOT_FOUND;
+
+  if (wal_frame != WAL_NOT_FOUND) {
+    // the log holds a newer image than the database file
+    wal_read_frame(pager->wal, wal_frame, frame->data);
+    frame->dirty = false;
+    pager->cache_misses++;
+  } else if (page_num < pager->file_len / pager->page_size) {
+    pager->cache_misses++;
+
+    if (pread(pager->fd, frame->data, pager->page_size,
+              pager_offset(pager, page_num)) != pager->page_size) {
+      DIE("Error reading file: %d\n", errno);
     }
+
+    pager->stats.bytes_read += pager->page_size;
+    pager->stats.syscalls++;
+
+    frame->dirty = false;
+  } else {
+    // a brand new page has no on-disk copy yet
+    memset(frame->data, 0, pager->page_size);
+    frame->dirty = true;
+  }
+
+  pager_hash_insert(pager, frame_idx);
+  pager_lru_push_front(pager, frame_idx);
+
+  if (page_num >= pager->num_pages) {
+    pager->num_pages = page_num + 1;
   }
+
+  return frame;
+}
+
+/*
+A page pointer from get_page is only safe while no other thread can evict or
+change the page. pager_pin keeps the page's frame resident until pager_unpin,
+which is enough to read a page nobody may write, like an internal node while
+the table is latched shared. pager_latch pins the page and then takes its latch
+in the given mode; pager_unlatch undoes both. Latches are only taken top-down
+and never while holding the pool lock, so they cannot deadlock. A pinned page
+stays in its frame, so the frame is found from the page's address, without the
+pool lock. A memory-mapped page never moves, and its pages are only written
+with the table latched exclusively, so there pinning and latching just return
+the page.
+*/
+static Frame* pager_page_frame(Pager* pager, void* page) {
+  size_t offset = (char*)page - (char*)pager->frame_data;
+
+  return &pager->frames[offset / pager->page_size];
+}
+
+void* pager_pin(Pager* pager, uint32_t page_num) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    return get_page(pager, page_num);
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  Frame* frame = pager_fetch(pager, page_num);
+  frame->pins++;
+  pthread_mutex_unlock(&pager->lock);
+
+  return frame->data;
+}
+
+void pager_unpin(Pager* pager, void* page) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    return;
+  }
+
+  pager_page_frame(pager, page)->pins--;
+}
+
+void pager_latch_pinned(Pager* pager, void* page, LatchMode mode) {
+  if (pager->mode == PAGER_MODE_MMAP || mode == LATCH_NONE) {
+    return;
+  }
+
+  Frame* frame = pager_page_frame(pager, page);
+
+  if (mode == LATCH_SHARED) {
+    pthread_rwlock_rdlock(&frame->latch);
+  } else {
+    pthread_rwlock_wrlock(&frame->latch);
+  }
+}
+
+void* pager_latch(Pager* pager, uint32_t page_num, LatchMode mode) {
+  if (mode == LATCH_NONE) {
+    return get_page(pager, page_num);
+  }
+
+  void* page = pager_pin(pager, page_num);
+  pager_latch_pinned(pager, page, mode);
+  return page;
+}
+
+void pager_unlatch(Pager* pager, void* page, LatchMode mode) {
+  if (pager->mode == PAGER_MODE_MMAP || mode == LATCH_NONE) {
+    return;
+  }
+
+  Frame* frame = pager_page_frame(pager, page);
+  pthread_rwlock_unlock(&frame->latch);
+  frame->pins--;
+}
+
+/*
+Freed pages form a list chained through their parent pointers. The header holds
+the head of the list, and 0 (the header's own page) ends it.
+*/
+
+/**
+ * @brief Return a page for a new node, reusing the most recently freed page
+ * before growing the file.
+ */
+uint32_t get_unused_page_num(Pager* pager) {
+  DbHeader* header = get_page(pager, 0);
+  uint32_t page_num = header->free_page_num;
+
+  if (page_num == 0) {
+    if (pager->num_pages == PAGER_MAX_PAGES) {
+      DIE("Database is full at %u pages\n", PAGER_MAX_PAGES);
+    }
+
+    return pager->num_pages;
+  }
+
+  uint32_t next_page_num = *get_parent_node(get_page(pager, page_num));
+
+  header = get_page(pager, 0);
+  header->free_page_num = next_page_num;
+  pager_mark_dirty(pager, 0);
+
+  return page_num;
+}
+
+/**
+ * @brief Hint the kernel to read the pages in runs of consecutive numbers,
+ * via madvise on the mapping or posix_fadvise on the file.
+ */
+static void pager_advise(Pager* pager, uint32_t* page_nums, uint32_t count) {
+  uint32_t hints = 0;
+
+  for (uint32_t i = 0; i < count;) {
+    uint32_t run = 1;
+    while (i + run < count && page_nums[i + run] == page_nums[i] + run) {
+      run++;
+    }
+
+    off_t offset = pager_offset(pager, page_nums[i]);
+    size_t len = (size_t)run * pager->page_size;
+
+    if (pager->mode == PAGER_MODE_MMAP) {
+      madvise(pager->map + offset, len, MADV_WILLNEED);
+    } else {
+      posix_fadvise(pager->fd, offset, len, POSIX_FADV_WILLNEED);
+    }
+
+    hints++;
+    i += run;
+  }
+
+  if (hints) {
+    pthread_mutex_lock(&pager->lock);
+    pager->stats.syscalls += hints;
+    pthread_mutex_unlock(&pager->lock);
+  }
+}
+
+/**
+ * @brief Start reading pages that will soon be fetched. With an io_uring the
+ * reads land directly in claimed frames, and get_page waits for them only if
+ * they are still in flight; otherwise the kernel is asked to read them into
+ * its page cache. Pages that are resident, newer in the log or not yet on
+ * disk are skipped.
+ */
+void pager_prefetch(Pager* pager, uint32_t* page_nums, uint32_t count) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    uint32_t mapped = 0;
+    while (mapped < count &&
+           (size_t)pager_offset(pager, page_nums[mapped] + 1) <=
+               pager->map_len) {
+      mapped++;
+    }
+
+    pager_advise(pager, page_nums, mapped);
+    return;
+  }
+
+  uint32_t wanted[count];
+  uint32_t num_wanted = 0;
+
+  // concurrent scans share the ring, so it bounds them as well as the pool
+  uint32_t max_in_flight = pager->num_frames / 4;
+  if (max_in_flight > pager->readahead->sq_entries) {
+    max_in_flight = pager->readahead->sq_entries;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t page_num = page_nums[i];
+
+    if (page_num >= pager->file_len / pager->page_size ||
+        pager_lookup(pager, page_num) != PAGER_NO_FRAME ||
+        (pager->wal &&
+         wal_find_frame(pager->wal, page_num) != WAL_NOT_FOUND)) {
+      continue;
+    }
+
+    if (!readahead_async(pager->readahead)) {
+      wanted[num_wanted++] = page_num;
+      continue;
+    }
+
+    if (pager->readahead->in_flight >= max_in_flight) {
+      break;
+    }
+
+    uint32_t frame_idx = pager_claim_frame(pager);
+    Frame* frame = &pager->frames[frame_idx];
+    frame->page_num = page_num;
+    frame->dirty = false;
+    frame->pending = true;
+    frame->prefetched = true;
+
+    pager_hash_insert(pager, frame_idx);
+    pager_lru_push_front(pager, frame_idx);
+
+    readahead_queue(pager->readahead, pager->fd, frame->data, pager->page_size,
+                    pager_offset(pager, page_num), frame_idx);
+  }
+
+  readahead_submit(pager->readahead);
+  pthread_mutex_unlock(&pager->lock);
+
+  pager_advise(pager, wanted, num_wanted);
+}
+
+/**
+ * @brief Put a page no longer referenced by the tree onto the free list.
+ */
+void pager_free_page(Pager* pager, uint32_t page_num) {
+  DbHeader* header = get_page(pager, 0);
+  uint32_t next_page_num = header->free_page_num;
+
+  void* page = get_page(pager, page_num);
+  memset(page, 0, pager->page_size);
+  *get_parent_node(page) = next_page_num;
+  pager_mark_dirty(pager, page_num);
+
+  header = get_page(pager, 0);
+  header->free_page_num = page_num;
+  pager_mark_dirty(pager, 0);
+}
+
+void pager_mark_dirty(Pager* pager, uint32_t page_num) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    // stores land in the shared mapping; the kernel writes them back
+    return;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  uint32_t frame_idx = pager_lookup(pager, page_num);
+
+  if (frame_idx == PAGER_NO_FRAME) {
+    DIE("Attempted to dirty non-resident page %u\n", page_num);
+  }
+
+  pager->frames[frame_idx].dirty = true;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+void pager_flush(Pager* pager, uint32_t page_num) {
+  if (pager->mode == PAGER_MODE_MMAP) {
+    return;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  uint32_t frame_idx = pager_lookup(pager, page_num);
+
+  if (frame_idx == PAGER_NO_FRAME) {
+    DIE("%s\n", "Attempted to flush null page");
+  }
+
+  pager_spill(pager, &pager->frames[frame_idx]);
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Write back every dirty frame, coalescing runs of adjacent page
+ * numbers into a single pwritev each. Clean frames cost nothing.
+ */
+void pager_flush_all(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  Frame** dirty = pager->dirty_frames;
+  uint32_t num_dirty = pager_collect_dirty(pager, dirty);
+
+  if (pager->unlogged) {
+    // pages that predate the unlogged transaction go out through the log
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < num_dirty; i++) {
+      if (dirty[i]->page_num >= pager->unlogged_from) {
+        dirty[kept++] = dirty[i];
+      }
+    }
+
+    num_dirty = kept;
+  }
+
+  uint32_t run_start = 0;
+  for (uint32_t i = 1; i <= num_dirty; i++) {
+    bool contiguous = i < num_dirty &&
+                      dirty[i]->page_num == dirty[i - 1]->page_num + 1 &&
+                      i - run_start < IOV_MAX;
+
+    if (!contiguous) {
+      pager_write_run(pager, &dirty[run_start], i - run_start);
+      run_start = i;
+    }
+  }
+
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Open an explicit transaction. Commits still waiting on a group sync
+ * are made durable first so they are not bundled with this one.
+ */
+void pager_begin(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  pager_sync(pager);
+  pager->in_transaction = true;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Open a transaction whose newly allocated pages are written straight
+ * to the database file instead of the log. Nothing committed can reference
+ * them until the commit, so a crash before then leaves them as unreferenced
+ * garbage. Pages that already existed are logged as usual.
+ */
+void pager_begin_unlogged(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  pager_begin(pager);
+  pager->unlogged = pager->wal != NULL;
+  pager->unlogged_from = pager->num_pages;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Write and sync the new pages of an unlogged transaction. Older pages
+ * stay dirty and go out through the log with the commit.
+ */
+void pager_end_unlogged(Pager* pager) {
+  if (!pager->unlogged) {
+    return;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  pager_flush_all(pager);
+
+  if (fsync(pager->fd) == -1) {
+    DIE("Error syncing: %d\n", errno);
+  }
+
+  pager->stats.syscalls++;
+  pager->unlogged = false;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief End the current transaction. Its changes become durable with the
+ * next group sync, which is forced once WAL_GROUP_COMMIT_MAX commits pile up;
+ * callers sync before telling anyone the commit succeeded.
+ */
+void pager_commit(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  pager->in_transaction = false;
+
+  if (++pager->pending_commits >= WAL_GROUP_COMMIT_MAX) {
+    pager_sync(pager);
+  }
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Make every pending commit durable with a single fsync.
+ * With a log, all dirty pages are appended as one commit group and the log is
+ * checkpointed once it grows past WAL_CHECKPOINT_FRAMES.
+ */
+static void pager_sync_locked(Pager* pager) {
+  if (pager->in_transaction) {
+    return;
+  }
+
+  if (pager->num_pages > 0) {
+    pager_write_header(pager);
+  }
+
+  if (pager->mode == PAGER_MODE_MMAP) {
+    // fdatasync writes back pages dirtied through the shared mapping too,
+    // at a cost proportional to the dirty pages rather than the mapping
+    if (pager->pending_commits) {
+      if (fdatasync(pager->fd) == -1) {
+        DIE("Error syncing: %d\n", errno);
+      }
+
+      pager->stats.syscalls++;
+    }
+
+    pager->pending_commits = 0;
+    return;
+  }
+
+  Wal* wal = pager->wal;
+  if (!wal) {
+    pager->pending_commits = 0;
+    return;
+  }
+
+  Frame** dirty = pager->dirty_frames;
+  uint32_t num_dirty = pager_collect_dirty(pager, dirty);
+
+  if (num_dirty == 0 && wal->num_frames == wal->committed_frames) {
+    pager->pending_commits = 0;
+    return;
+  }
+
+  if (num_dirty == 0) {
+    // Everything was spilled already; re-log the header to carry the commit
+    // mark
+    dirty[num_dirty++] = pager_fetch(pager, 0);
+  }
+
+  uint32_t* page_nums = pager->dirty_page_nums;
+  void** pages = pager->dirty_pages;
+
+  for (uint32_t i = 0; i < num_dirty; i++) {
+    page_nums[i] = dirty[i]->page_num;
+    pages[i] = dirty[i]->data;
+    dirty[i]->dirty = false;
+  }
+
+  wal_append(wal, page_nums, pages, num_dirty, pager->num_pages);
+  wal_sync(wal);
+  pager->pending_commits = 0;
+
+  if (wal->num_frames >= WAL_CHECKPOINT_FRAMES) {
+    pager_checkpoint(pager);
+  }
+}
+
+void pager_sync(Pager* pager) {
+  pthread_mutex_lock(&pager->lock);
+  pager_sync_locked(pager);
+  pthread_mutex_unlock(&pager->lock);
+}
+
+/**
+ * @brief Copy the latest image of every logged page into the database file,
+ * sync it, and empty the log. Only called with no transaction in flight.
+ */
+void pager_checkpoint(Pager* pager) {
+  Wal* wal = pager->wal;
+  void* page = malloc(pager->page_size);
+
+  pthread_mutex_lock(&pager->lock);
+
+  for (uint32_t page_num = 0; page_num < wal->page_frames_len; page_num++) {
+    uint32_t frame_num = wal_find_frame(wal, page_num);
+    if (frame_num == WAL_NOT_FOUND) {
+      continue;
+    }
+
+    wal_read_frame(wal, frame_num, page);
+
+    off_t offset = pager_offset(pager, page_num);
+    if (pwrite(pager->fd, page, pager->page_size, offset) != pager->page_size) {
+      DIE("Error writing: %d\n", errno);
+    }
+
+    pager->stats.bytes_written += pager->page_size;
+    pager->stats.syscalls++;
+
+    if ((uint64_t)offset + pager->page_size > pager->file_len) {
+      pager->file_len = offset + pager->page_size;
+    }
+  }
+
+  if (fsync(pager->fd) == -1) {
+    DIE("Error syncing: %d\n", errno);
+  }
+
+  pager->stats.syscalls++;
+  wal_reset(wal);
+  pthread_mutex_unlock(&pager->lock);
+  free(page);
+}
+
+/**
+ * @brief Copy the pager's counters, adding in those of its log and read-ahead
+ * ring, so that they are consistent with one another.
+ */
+void pager_stats(Pager* pager, PagerStats* stats) {
+  pthread_mutex_lock(&pager->lock);
+  *stats = pager->stats;
+
+  if (pager->wal) {
+    stats->bytes_read += pager->wal->bytes_read;
+    stats->bytes_written += pager->wal->bytes_written;
+    stats->syscalls += pager->wal->syscalls;
+  }
+
+  if (pager->readahead) {
+    stats->syscalls += pager->readahead->syscalls;
+  }
+
+  pthread_mutex_unlock(&pager->lock);
+}
+
+const char* row_column(Row* row, Column column) {
+  return column == COLUMN_USERNAME ? row->username : row->email;
+}
+
+/**
+ * @brief Return the number of bytes serialize_row writes for row.
+ */
+uint32_t row_size(Row* row) {
+  return ID_SIZE + ROW_LENGTH_SIZE + strlen(row->username) + ROW_LENGTH_SIZE +
+         strlen(row->email);
+}
+
+/**
+ * @brief Return the size of the serialized row at src from its length bytes.
+ */
+uint32_t serialized_row_size(void* src) {
+  uint8_t username_len = *(uint8_t*)(src + ID_SIZE);
+  uint8_t email_len =
+      *(uint8_t*)(src + ID_SIZE + ROW_LENGTH_SIZE + username_len);
+
+  return ID_SIZE + ROW_LENGTH_SIZE + username_len + ROW_LENGTH_SIZE +
+         email_len;
+}
+
+static void* serialize_column(const char* src, void* dest) {
+  uint8_t len = strlen(src);
+
+  *(uint8_t*)dest = len;
+  memcpy(dest + ROW_LENGTH_SIZE, src, len);
+
+  return dest + ROW_LENGTH_SIZE + len;
+}
+
+static void* deserialize_column(void* src, char* dest) {
+  uint8_t len = *(uint8_t*)src;
+
+  memcpy(dest, src + ROW_LENGTH_SIZE, len);
+  dest[len] = '\0';
+
+  return src + ROW_LENGTH_SIZE + len;
+}
+
+/**
+ * @brief Write row to dest in its variable-length form and return the number
+ * of bytes written.
+ */
+uint32_t serialize_row(Row* src, void* dest) {
+  void* end = dest;
+
+  memcpy(end, &(src->id), ID_SIZE);
+  end = serialize_column(src->username, end + ID_SIZE);
+  end = serialize_column(src->email, end);
+
+  return end - dest;
+}
+
+void deserialize_row(void* src, Row* dest) {
+  memcpy(&(dest->id), src, ID_SIZE);
+  src = deserialize_column(src + ID_SIZE, dest->username);
+  deserialize_column(src, dest->email);
+}
+
+/**
+ * @brief Return the position of the lowest id (start of left-most leaf node)
+ */
+void cursor_start_init(Table* table, Cursor* cursor) {
+  table_seek(table, 0, cursor);
+}
+
+/*
+Move a cursor onto the leaf after its current one, to resume at the first row
+whose id is at least key. A latched cursor lets go of the table between leaves
+so that waiting writers get a turn. If one of them restructured the tree in
+the meantime, next_page_num may no longer be the right leaf, so the cursor
+seeks key from the root instead.
+*/
+static void cursor_next_leaf(Cursor* cursor, uint32_t next_page_num,
+                             uint64_t key) {
+  Table* table = cursor->table;
+
+  if (cursor->latch != LATCH_NONE) {
+    uint32_t epoch = table->epoch;
+
+    pager_unlatch(table->pager, cursor->node, cursor->latch);
+    table_unlock(table);
+    table_lock(table, LATCH_SHARED);
+
+    if (table->epoch != epoch) {
+      Cursor found;
+      table_find(table, key, cursor->latch, &found);
+      cursor->page_num = found.page_num;
+      cursor->cell_num = found.cell_num;
+      cursor->node = found.node;
+      return;
+    }
+
+    cursor->node = pager_latch(table->pager, next_page_num, cursor->latch);
+  }
+
+  cursor->page_num = next_page_num;
+  cursor->cell_num = 0;
+}
+
+/**
+ * @brief Step a cursor positioned past the end of its leaf on to the first row
+ * whose id is at least key, or to the end of the table.
+ */
+static void cursor_settle(Cursor* cursor, uint64_t key) {
+  while (1) {
+    void* node = cursor_node(cursor);
+
+    if (cursor->cell_num < *leaf_node_num_cells(node)) {
+      return;
+    }
+
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      cursor->end = true;
+      return;
+    }
+
+    cursor_next_leaf(cursor, next_page_num, key);
+  }
+}
+
+/**
+ * @brief Return the position of the first row whose id is at least key,
+ * stepping to the next leaf when key falls past the end of its leaf.
+ */
+void table_seek(Table* table, uint64_t key, Cursor* cursor) {
+  table_find_by_key(table, key, cursor);
+  cursor_settle(cursor, key);
+}
+
+/**
+ * @brief Like table_seek, for a reader that may run alongside other threads.
+ * The table and the cursor's leaf stay latched shared until cursor_close.
+ */
+void table_scan(Table* table, uint64_t key, Cursor* cursor) {
+  table_lock(table, LATCH_SHARED);
+  table_find(table, key, LATCH_SHARED, cursor);
+  cursor_settle(cursor, key);
+}
+
+/**
+ * @brief Release what a cursor holds. Cursors live in their callers' storage,
+ * so there is nothing to free.
+ */
+void cursor_close(Cursor* cursor) {
+  if (cursor->latch != LATCH_NONE) {
+    pager_unlatch(cursor->table->pager, cursor->node, cursor->latch);
+    table_unlock(cursor->table);
+  }
+}
+
+/**
+ * @brief Return the position of the given key.
+ * If the key is not extant, return the position
+ * where it should be inserted.
+ */
+void table_find_by_key(Table* table, uint64_t key, Cursor* cursor) {
+  table_find(table, key, LATCH_NONE, cursor);
+}
+
+/**
+ * @brief Find the position of key with latch-coupled descent: each node on
+ * the way down is latched before its parent is released, and the leaf stays
+ * latched in the given mode. The caller holds the table latch.
+ */
+void table_find(Table* table, uint64_t key, LatchMode mode, Cursor* cursor) {
+  uint32_t root_page_num = table->root_page_num;
+  void* root_node = node_latch(table->pager, root_page_num, mode);
+
+  atomic_fetch_add_explicit(&table->stats.descents, 1, memory_order_relaxed);
+
+  if (get_node_type(root_node) == NODE_LEAF) {
+    leaf_node_find(table, root_page_num, root_node, key, cursor);
+  } else {
+    internal_node_find(table, root_node, key, mode, cursor);
+  }
+
+  // remember the rightmost leaf for appends, without dirtying a cache line
+  // that every descent reads
+  if (*leaf_node_next_leaf(cursor->node) == 0 &&
+      atomic_load_explicit(&table->last_leaf, memory_order_relaxed) !=
+          cursor->page_num) {
+    atomic_store_explicit(&table->last_leaf, cursor->page_num,
+                          memory_order_relaxed);
+  }
+
+  cursor->latch = mode;
+}
+
+/**
+ * @brief Return the cursor's leaf. A latched cursor holds it pinned already,
+ * which spares a trip through the pool.
+ */
+void* cursor_node(Cursor* cursor) {
+  if (cursor->latch != LATCH_NONE) {
+    return cursor->node;
+  }
+
+  return get_page(cursor->table->pager, cursor->page_num);
+}
+
+void* cursor_value(Cursor* cursor) {
+  return leaf_node_value(cursor_node(cursor), cursor->cell_num);
+}
+
+/*
+Read ahead of a scan that has just stepped onto a new leaf. The leaves that
+follow are the next children of the leaf's parent, so those are requested
+before the scan reaches them, along with the parent's right neighbour once the
+window runs past the parent's last child. The window doubles whenever the scan
+had to wait on a read since the previous leaf, and halves when read-ahead pages
+were evicted before the scan got to them.
+*/
+static void cursor_readahead(Cursor* cursor) {
+  Pager* pager = cursor->table->pager;
+  void* node = cursor_node(cursor);
+
+  uint32_t max = PAGER_READAHEAD_MAX;
+  if (pager->mode == PAGER_MODE_BUFFERED && pager->num_frames / 4 < max) {
+    max = pager->num_frames / 4;
+  }
+
+  pthread_mutex_lock(&pager->lock);
+  uint32_t stalls = pager->cache_misses + pager->prefetch_stalls;
+  uint32_t wasted = pager->prefetch_wasted;
+  pthread_mutex_unlock(&pager->lock);
+
+  if (cursor->readahead == 0) {
+    cursor->readahead = PAGER_READAHEAD_MIN;
+  } else if (wasted != cursor->readahead_wasted) {
+    cursor->readahead /= 2;
+  } else if (stalls != cursor->readahead_stalls) {
+    cursor->readahead *= 2;
+  }
+
+  if (cursor->readahead < PAGER_READAHEAD_MIN) {
+    cursor->readahead = PAGER_READAHEAD_MIN;
+  } else if (cursor->readahead > max) {
+    cursor->readahead = max;
+  }
+
+  if (!is_root_node(node)) {
+    uint32_t page_nums[PAGER_READAHEAD_MAX + 1];
+    uint32_t count = 0;
+    uint64_t key = *leaf_node_key(node, 0);
+    uint32_t parent_page_num = *get_parent_node(node);
+
+    void* parent = pager_pin(pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+
+    for (uint32_t i = internal_node_find_child(parent, key) + 1;
+         i <= num_keys && count < cursor->readahead; i++) {
+      page_nums[count++] = *internal_node_child(pager, parent, i);
+    }
+
+    if (count < cursor->readahead && !is_root_node(parent)) {
+      uint32_t grandparent_page_num = *get_parent_node(parent);
+      void* grandparent = pager_pin(pager, grandparent_page_num);
+      uint32_t idx = internal_node_find_child(grandparent, key);
+
+      if (idx < *internal_node_num_keys(grandparent)) {
+        page_nums[count++] =
+            *internal_node_child(pager, grandparent, idx + 1);
+      }
+
+      pager_unpin(pager, grandparent);
+    }
+
+    pager_unpin(pager, parent);
+    pager_prefetch(pager, page_nums, count);
+  }
+
+  // the fetches made here are not the scan's own stalls
+  pthread_mutex_lock(&pager->lock);
+  cursor->readahead_stalls = pager->cache_misses + pager->prefetch_stalls;
+  cursor->readahead_wasted = pager->prefetch_wasted;
+  pthread_mutex_unlock(&pager->lock);
+}
+
+void cursor_advance(Cursor* cursor) {
+  void* node = cursor_node(cursor);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  cursor->cell_num++;
+  if (cursor->cell_num < num_cells) {
+    return;
+  }
+
+  // Resume past the last row of this leaf, in whichever leaf now holds it
+  uint64_t last_key = *leaf_node_key(node, num_cells - 1);
+  if (last_key == UINT64_MAX) {
+    cursor->end = true;
+    return;
+  }
+
+  uint32_t page_num = cursor->page_num;
+  cursor_settle(cursor, last_key + 1);
+
+  if (!cursor->end && cursor->page_num != page_num) {
+    cursor_readahead(cursor);
+  }
+}
+
+/**
+ * @brief Move the cursor past the rest of its leaf, onto the first row of the
+ * next one, for callers that take in a leaf at a time.
+ */
+void cursor_skip_leaf(Cursor* cursor) {
+  uint32_t num_cells = *leaf_node_num_cells(cursor_node(cursor));
+
+  if (num_cells == 0) {
+    cursor->end = true;
+    return;
+  }
+
+  cursor->cell_num = num_cells - 1;
+  cursor_advance(cursor);
 }
@@ -1,15 +1,95 @@
 #ifndef PAGER_H
 #define PAGER_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #include "common.h"
+#include "filter.h"
+#include "readahead.h"
+#include "wal.h"
 
 #define sizeof_attr(Struct, Attr) sizeof(((Struct*)0)->Attr)
 
-#define TABLE_MAX_PAGES 100
+/**
+ * @brief Number of page frames in the buffer pool when no size is given.
+ */
+#define PAGER_DEFAULT_FRAMES 1024
+
+/**
+ * @brief Smallest buffer pool we will run with. Page pointers handed out by
+ * get_page remain valid until PAGER_MIN_FRAMES - 1 other pages have been
+ * fetched, which bounds how many nodes a single btree operation may hold.
+ */
+#define PAGER_MIN_FRAMES 16
+
+/**
+ * @brief Page sizes a database may be created with, each a power of two.
+ * A database keeps the size it was created with, recorded in its header.
+ */
+#define PAGE_DEFAULT_SIZE 4096
+#define PAGE_MIN_SIZE 4096
+#define PAGE_MAX_SIZE 65536
+
+/**
+ * @brief Most pages a database holds. Page numbers stay 32 bits, which
+ * address 16 TB of 4 KB pages; the last number is left unused so that a count
+ * of pages always fits.
+ */
+#define PAGER_MAX_PAGES UINT32_MAX
+
+/**
+ * @brief Sentinel for "no frame" in the pool's lookup chains and LRU list.
+ */
+#define PAGER_NO_FRAME UINT32_MAX
+
+/**
+ * @brief Address space reserved up front for a memory-mapped database. The
+ * file mapping is extended in place within it, so page pointers never move.
+ */
+#define PAGER_MMAP_RESERVE ((size_t)1 << 40)
+
+/**
+ * @brief Smallest step by which a memory-mapped database file is grown.
+ */
+#define PAGER_MMAP_MIN_GROWTH ((size_t)1 << 20)
+
+/**
+ * @brief Bounds on how many leaves a scan reads ahead of itself. A buffered
+ * pager further caps the window at a quarter of its frames.
+ */
+#define PAGER_READAHEAD_MIN 2
+#define PAGER_READAHEAD_MAX 64
+
+/**
+ * @brief How the pager brings pages into memory.
+ * Buffered mode copies pages into a bounded pool of frames with read/write;
+ * mmap mode hands out pointers directly into a shared mapping of the file.
+ */
+typedef enum {
+  PAGER_MODE_BUFFERED,
+  PAGER_MODE_MMAP,
+} PagerMode;
+
+typedef struct {
+  PagerMode mode;
+  uint32_t num_frames;  // buffered mode only
+  bool wal;             // buffered mode only
+  uint32_t page_size;   // for a new database; 0 for PAGE_DEFAULT_SIZE
+} PagerOptions;
+
+/**
+ * @brief What a thread holds on a page, or on the whole tree.
+ * Shared holders may read, an exclusive holder may write.
+ */
+typedef enum {
+  LATCH_NONE,
+  LATCH_SHARED,
+  LATCH_EXCLUSIVE,
+} LatchMode;
 
 /**
  * @brief Node type identifier, where a node corresponds to one page.
@@ -19,22 +99,132 @@
 typedef enum {
   NODE_INTERNAL,
   NODE_LEAF,
+  NODE_INDEX_INTERNAL,
+  NODE_INDEX_LEAF,
 } NodeType;
 
+/**
+ * @brief The text columns of a row, which can be indexed and compared.
+ */
+typedef enum {
+  COLUMN_USERNAME,
+  COLUMN_EMAIL,
+  COLUMN_COUNT,
+} Column;
+
+/**
+ * @brief A buffer pool slot holding one resident page.
+ * Frames are linked into a hash chain keyed by page number and into a
+ * doubly-linked LRU list, both by frame index.
+ */
+typedef struct {
+  uint32_t page_num;
+  uint32_t hash_next;
+  uint32_t lru_prev;
+  uint32_t lru_next;
+  bool dirty;
+  bool pending;     // an asynchronous read into data is in flight
+  bool prefetched;  // read ahead and not yet fetched
+  _Atomic uint32_t pins;  // holders and waiters; a pinned frame stays put
+  pthread_rwlock_t latch;
+  void* data;
+} Frame;
+
+/**
+ * @brief Counters kept by a buffered pager since it was opened, under its
+ * lock. A memory-mapped pager leaves hits, misses and evictions to the kernel
+ * and counts only its own system calls.
+ */
+typedef struct {
+  uint64_t hits;           // fetches that found the page resident
+  uint64_t misses;         // fetches that had to read or create the page
+  uint64_t evictions;      // resident pages dropped to make room
+  uint64_t bytes_read;     // from the database file and the log
+  uint64_t bytes_written;  // to the database file and the log
+  uint64_t syscalls;       // reads, writes, syncs, truncates and hints
+} PagerStats;
+
+/**
+ * @brief The pager may be shared by several threads. Its own bookkeeping (the
+ * frame table, LRU list, log and read-ahead ring) is guarded by lock, which
+ * is recursive so pager functions can call one another. Page contents are
+ * guarded by the frame latches, see pager_latch.
+ */
 typedef struct {
   int fd;
-  uint32_t file_len;
+  char* filename;
+  pthread_mutex_t lock;
+  uint64_t file_len;  // bytes of the database file on disk
+  uint32_t page_size;
   uint32_t num_pages;
-  void* pages[TABLE_MAX_PAGES];
+  _Atomic uint64_t num_rows;  // rows in the table; see pager_write_header
+  PagerMode mode;
+
+  void* map;
+  size_t map_len;
+
+  uint32_t num_frames;
+  uint32_t frames_used;
+  Frame* frames;
+  void* frame_data;
+
+  uint32_t num_buckets;
+  uint32_t* buckets;
+
+  uint32_t lru_head;  // most recently used
+  uint32_t lru_tail;  // least recently used; next eviction victim
+
+  // room for every frame and one more, so that syncs and flushes gather the
+  // dirty pages without allocating
+  Frame** dirty_frames;
+  uint32_t* dirty_page_nums;
+  void** dirty_pages;
+
+  Wal* wal;  // NULL when writing straight to the database file
+  bool in_transaction;
+  bool unlogged;          // new pages bypass the log (bulk loads)
+  uint32_t unlogged_from;  // first page allocated while unlogged
+  uint32_t pending_commits;  // committed but not yet synced
+
+  Readahead* readahead;  // buffered mode only
+  uint32_t cache_misses;     // fetches that read the page synchronously
+  uint32_t prefetch_stalls;  // fetches that waited on a read-ahead
+  uint32_t prefetch_wasted;  // read-ahead pages evicted before use
+  PagerStats stats;  // the log and read-ahead ring keep their own counts
 } Pager;
 
+/**
+ * @brief Counters kept by a table's B-tree since it was opened. They are
+ * bumped by threads holding the table latched shared as well as exclusively,
+ * so they are atomic, and relaxed: no other memory is ordered by them.
+ */
+typedef struct {
+  _Atomic uint64_t descents;         // walks from the root to a leaf
+  _Atomic uint64_t leaf_splits;
+  _Atomic uint64_t internal_splits;
+  _Atomic uint64_t cells_shifted;    // slots moved right to insert a cell
+} TreeStats;
+
+/**
+ * @brief Lookups, scans and inserts that fit in their leaf hold latch shared
+ * and latch the pages they touch. Anything that may restructure the tree
+ * (a split, merge or bulk load) holds it exclusively instead, and bumps epoch
+ * so that scans paused between leaves know to find their place again.
+ */
 typedef struct {
   uint32_t root_page_num;
   Pager* pager;
+  pthread_rwlock_t latch;
+  uint32_t epoch;
+  uint32_t index_roots[COLUMN_COUNT];  // root page of each index, 0 if none
+  KeyFilter filter;                    // every id in the table, and then some
+  TreeStats stats;
+  _Atomic uint32_t last_leaf;  // the rightmost leaf when last seen, see
+                               // table_find_append
 } Table;
 
 typedef struct {
-  uint32_t id;
+  uint64_t id;
   char username[COLUMN_USERNAME_SIZE + 1];
   char email[COLUMN_EMAIL_SIZE + 1];
 } Row;
@@ -44,41 +234,135 @@ typedef struct {
   uint32_t page_num;
   uint32_t cell_num;
   bool end;  // where end is 1 position past the last element
+  LatchMode latch;  // held on the leaf, with the table latched shared
+  void* node;       // the leaf, while it is latched
+
+  uint32_t readahead;         // leaves read ahead; 0 until a scan starts
+  uint32_t readahead_stalls;  // pager stalls and misses at the last leaf
+  uint32_t readahead_wasted;  // pager wasted read-aheads at the last leaf
 } Cursor;
 
 static const uint32_t ID_SIZE = sizeof_attr(Row, id);
 static const uint32_t USERNAME_SIZE = sizeof_attr(Row, username);
 static const uint32_t EMAIL_SIZE = sizeof_attr(Row, email);
 
-static const uint32_t ID_OFFSET = 0;
-static const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-static const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-static const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+// On disk a row is its id followed by each text column as a one-byte length
+// and that many bytes, without padding or terminator
+static const uint32_t ROW_LENGTH_SIZE = sizeof(uint8_t);
+static const uint32_t ROW_MAX_SIZE = ID_SIZE + ROW_LENGTH_SIZE +
+                                     COLUMN_USERNAME_SIZE + ROW_LENGTH_SIZE +
+                                     COLUMN_EMAIL_SIZE;
 
-static const uint32_t PAGE_SIZE = 4096;
+/**
+ * @brief Marks a database file and the layout of its pages. Version 2 widened
+ * ids and keys to 64 bits, and version 3 gave the header its page size, counts
+ * and free list. Version 1 files have no header, their page 0 being the root;
+ * they and version 2 files are refused rather than misread.
+ */
+#define DB_MAGIC 0x42444250  // "PBDB"
+#define DB_FORMAT_VERSION 3
 
-Table* db_open(const char* filename);
+/**
+ * @brief The start of page 0 of a database file, the rest of which is unused.
+ * It is read before anything else, to size the buffer pool for the file's
+ * pages, and is then kept like any other page: the free list head changes in
+ * place, and the counts are brought up to date as commits are made durable.
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t root_page_num;
+  uint32_t num_pages;      // pages in use, this one included
+  uint32_t free_page_num;  // head of the free list, 0 if it is empty
+  uint64_t num_rows;       // rows in the table
+} DbHeader;
+
+/**
+ * @brief Where a new database puts the table's root, which never moves.
+ */
+#define PAGER_ROOT_PAGE_NUM 1
+
+Table* db_open(const char* filename, const PagerOptions* options);
 
 void db_close(Table* table);
 
-Pager* pager_open(const char* filename);
+bool db_set_page_size(Table* table, uint32_t page_size);
+
+bool page_size_valid(uint32_t page_size);
+
+void table_lock(Table* table, LatchMode mode);
+
+void table_unlock(Table* table);
+
+Pager* pager_open(const char* filename, const PagerOptions* options);
 
 void pager_flush(Pager* pager, uint32_t page_num);
 
+void pager_flush_all(Pager* pager);
+
+void pager_mark_dirty(Pager* pager, uint32_t page_num);
+
+void pager_begin(Pager* pager);
+
+void pager_commit(Pager* pager);
+
+void pager_sync(Pager* pager);
+
+void pager_begin_unlogged(Pager* pager);
+
+void pager_end_unlogged(Pager* pager);
+
+void pager_checkpoint(Pager* pager);
+
 void* get_page(Pager* pager, uint32_t page_num);
 
+void* pager_pin(Pager* pager, uint32_t page_num);
+
+void pager_unpin(Pager* pager, void* page);
+
+void pager_latch_pinned(Pager* pager, void* page, LatchMode mode);
+
+void* pager_latch(Pager* pager, uint32_t page_num, LatchMode mode);
+
+void pager_unlatch(Pager* pager, void* page, LatchMode mode);
+
 uint32_t get_unused_page_num(Pager* pager);
 
-void serialize_row(Row* src, void* dest);
+void pager_free_page(Pager* pager, uint32_t page_num);
+
+void pager_prefetch(Pager* pager, uint32_t* page_nums, uint32_t count);
+
+void pager_stats(Pager* pager, PagerStats* stats);
+
+uint32_t row_size(Row* row);
+
+const char* row_column(Row* row, Column column);
+
+uint32_t serialized_row_size(void* src);
+
+uint32_t serialize_row(Row* src, void* dest);
 
 void deserialize_row(void* src, Row* dest);
 
+void* cursor_node(Cursor* cursor);
+
 void* cursor_value(Cursor* cursor);
 
-Cursor* cursor_start_init(Table* table);
+void cursor_start_init(Table* table, Cursor* cursor);
+
+void table_find_by_key(Table* table, uint64_t key, Cursor* cursor);
+
+void table_find(Table* table, uint64_t key, LatchMode mode, Cursor* cursor);
 
-Cursor* table_find_by_key(Table* table, uint32_t key);
+void table_seek(Table* table, uint64_t key, Cursor* cursor);
+
+void table_scan(Table* table, uint64_t key, Cursor* cursor);
+
+void cursor_close(Cursor* cursor);
 
 void cursor_advance(Cursor* cursor);
 
+void cursor_skip_leaf(Cursor* cursor);
+
 #endif /* PAGER_H */
@@ -1,56 +1,432 @@
 #include "preparator.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "common.h"
 
+/**
+ * @brief A slice of the input buffer; tokens are never copied or terminated.
+ */
+typedef struct {
+  const char* start;
+  uint32_t len;
+} Token;
+
+/**
+ * @brief Return the next run of characters up to a space, the end of input
+ * or one of stops, and move input past it. The token is empty if input is
+ * exhausted or sits on a stop character.
+ */
+static Token next_token(const char** input, const char* stops) {
+  const char* p = *input;
+
+  while (*p == ' ') {
+    p++;
+  }
+
+  Token token = {.start = p, .len = 0};
+  while (p[token.len] != '\0' && p[token.len] != ' ' &&
+         !strchr(stops, p[token.len])) {
+    token.len++;
+  }
+
+  *input = p + token.len;
+  return token;
+}
+
+/**
+ * @brief Consume the given punctuation character if it comes next, ignoring
+ * leading spaces.
+ */
+static bool next_char(const char** input, char c) {
+  const char* p = *input;
+
+  while (*p == ' ') {
+    p++;
+  }
+
+  if (*p != c) {
+    return false;
+  }
+
+  *input = p + 1;
+  return true;
+}
+
+static bool at_end(const char* input) {
+  while (*input == ' ') {
+    input++;
+  }
+
+  return *input == '\0';
+}
+
+static bool token_is(Token token, const char* word) {
+  return token.len == strlen(word) && memcmp(token.start, word, token.len) == 0;
+}
+
+/**
+ * @brief Parse a decimal id, rejecting anything that would not fit in a
+ * uint64_t rather than letting it wrap.
+ */
+static PrepareResult parse_id(Token token, uint64_t* id) {
+  const char* p = token.start;
+  const char* end = token.start + token.len;
+  bool negative = p < end && *p == '-';
+
+  if (negative) {
+    p++;
+  }
+
+  if (p == end) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  uint64_t value = 0;
+  for (; p < end; p++) {
+    if (*p < '0' || *p > '9') {
+      return PREPARE_SYNTAX_ERROR;
+    }
+
+    uint32_t digit = *p - '0';
+    if (value > (UINT64_MAX - digit) / 10) {
+      return negative ? PREPARE_NEGATIVE_ID : PREPARE_ID_OUT_OF_RANGE;
+    }
+
+    value = value * 10 + digit;
+  }
+
+  if (negative && value != 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+
+  *id = value;
+  return PREPARE_SUCCESS;
+}
+
+static PrepareResult parse_column(Token token, char* dest, uint32_t max_len) {
+  if (token.len == 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  if (token.len > max_len) {
+    return PREPARE_INPUT_TOO_LONG;
+  }
+
+  memcpy(dest, token.start, token.len);
+  dest[token.len] = '\0';
+  return PREPARE_SUCCESS;
+}
+
+/**
+ * @brief Parse the "id username email" fields of a row, each ending at a
+ * space or one of stops.
+ */
+static PrepareResult parse_row(const char** input, const char* stops,
+                               Row* row) {
+  Token id = next_token(input, stops);
+  Token username = next_token(input, stops);
+  Token email = next_token(input, stops);
+  PrepareResult result;
+
+  if (id.len == 0) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  if ((result = parse_column(username, row->username, COLUMN_USERNAME_SIZE)) !=
+          PREPARE_SUCCESS ||
+      (result = parse_column(email, row->email, COLUMN_EMAIL_SIZE)) !=
+          PREPARE_SUCCESS) {
+    return result;
+  }
+
+  return parse_id(id, &row->id);
+}
+
+static Row* statement_add_row(Statement* statement) {
+  if (statement->num_rows == statement->rows_capacity) {
+    statement->rows_capacity =
+        statement->rows_capacity ? statement->rows_capacity * 2 : 16;
+    statement->rows =
+        realloc(statement->rows, statement->rows_capacity * sizeof(Row));
+  }
+
+  return &statement->rows[statement->num_rows++];
+}
+
+/**
+ * @brief Parse "insert id username email" or a batch of rows written as
+ * "insert (id username email), (id username email), ...". Inside
+ * parentheses a column ends at a space or the closing parenthesis.
+ */
 PrepareResult prepare_insert(StringBuffer* buffer, Statement* statement) {
+  const char* input = buffer->buffer;
+  PrepareResult result;
+
   statement->type = STATEMENT_INSERT;
+  statement->num_rows = 0;
+
+  if (!token_is(next_token(&input, "("), "insert")) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  if (!next_char(&input, '(')) {
+    if ((result = parse_row(&input, "", statement_add_row(statement))) !=
+        PREPARE_SUCCESS) {
+      return result;
+    }
+
+    return at_end(input) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+  }
+
+  do {
+    if ((result = parse_row(&input, ")", statement_add_row(statement))) !=
+        PREPARE_SUCCESS) {
+      return result;
+    }
 
-  char* keyword = strtok(buffer->buffer, " ");
+    if (!next_char(&input, ')')) {
+      return PREPARE_SYNTAX_ERROR;
+    }
 
-  char* id_str = strtok(NULL, " ");
-  if (id_str == NULL) {
+    if (at_end(input)) {
+      return PREPARE_SUCCESS;
+    }
+  } while (next_char(&input, ',') && next_char(&input, '('));
+
+  return PREPARE_SYNTAX_ERROR;
+}
+
+/**
+ * @brief Parse the "id username email" fields of a line holding one row.
+ */
+PrepareResult prepare_row(const char* input, Row* row) {
+  PrepareResult result = parse_row(&input, "", row);
+
+  if (result == PREPARE_SUCCESS && !at_end(input)) {
     return PREPARE_SYNTAX_ERROR;
   }
 
-  char* username = strtok(NULL, " ");
-  if (username == NULL) {
+  return result;
+}
+
+/**
+ * @brief Parse the name of an indexable column.
+ */
+static bool parse_column_name(Token token, Column* column) {
+  if (token_is(token, "username")) {
+    *column = COLUMN_USERNAME;
+  } else if (token_is(token, "email")) {
+    *column = COLUMN_EMAIL;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Parse the rest of a statement as "where id = N" or
+ * "where id between A and B" into its id range, or, if by_column is allowed,
+ * as "where username = V" or "where email = V". Without a where clause the
+ * range covers every id, unless one is required.
+ */
+static PrepareResult prepare_where(const char* input, Statement* statement,
+                                   bool required, bool by_column) {
+  statement->id_min = 0;
+  statement->id_max = UINT64_MAX;
+  statement->by_column = false;
+
+  if (at_end(input)) {
+    return required ? PREPARE_SYNTAX_ERROR : PREPARE_SUCCESS;
+  }
+
+  if (!token_is(next_token(&input, ""), "where")) {
     return PREPARE_SYNTAX_ERROR;
   }
 
-  if (strlen(username) > COLUMN_USERNAME_SIZE) {
-    return PREPARE_INPUT_TOO_LONG;
+  Token column = next_token(&input, "");
+  PrepareResult result;
+
+  if (by_column && parse_column_name(column, &statement->column)) {
+    if (!token_is(next_token(&input, ""), "=")) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+
+    uint32_t max_len = statement->column == COLUMN_USERNAME
+                           ? COLUMN_USERNAME_SIZE
+                           : COLUMN_EMAIL_SIZE;
+    if ((result = parse_column(next_token(&input, ""), statement->value,
+                               max_len)) != PREPARE_SUCCESS) {
+      return result;
+    }
+
+    statement->by_column = true;
+    return at_end(input) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
   }
 
-  char* email = strtok(NULL, " ");
-  if (email == NULL) {
+  if (!token_is(column, "id")) {
     return PREPARE_SYNTAX_ERROR;
   }
 
-  if (strlen(email) > COLUMN_EMAIL_SIZE) {
-    return PREPARE_INPUT_TOO_LONG;
+  Token op = next_token(&input, "");
+
+  if (token_is(op, "=")) {
+    if ((result = parse_id(next_token(&input, ""), &statement->id_min)) !=
+        PREPARE_SUCCESS) {
+      return result;
+    }
+
+    statement->id_max = statement->id_min;
+  } else if (token_is(op, "between")) {
+    if ((result = parse_id(next_token(&input, ""), &statement->id_min)) !=
+        PREPARE_SUCCESS) {
+      return result;
+    }
+
+    if (!token_is(next_token(&input, ""), "and")) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+
+    if ((result = parse_id(next_token(&input, ""), &statement->id_max)) !=
+        PREPARE_SUCCESS) {
+      return result;
+    }
+  } else {
+    return PREPARE_SYNTAX_ERROR;
   }
 
-  int id = atoi(id_str);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID;
+  return at_end(input) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+/**
+ * @brief Parse "count(*)", "min(id)", "max(id)" or "sum(id)" if one comes
+ * next, moving input past it. Anything else is left for the where clause.
+ */
+static PrepareResult prepare_aggregate(const char** input,
+                                       Statement* statement) {
+  static const struct {
+    const char* name;
+    const char* argument;
+    Aggregate aggregate;
+  } functions[] = {
+      {"count", "*", AGGREGATE_COUNT},
+      {"min", "id", AGGREGATE_MIN},
+      {"max", "id", AGGREGATE_MAX},
+      {"sum", "id", AGGREGATE_SUM},
+  };
+
+  const char* p = *input;
+  Token name = next_token(&p, "(");
+  statement->aggregate = AGGREGATE_NONE;
+
+  if (!next_char(&p, '(')) {
+    return PREPARE_SUCCESS;
   }
 
-  statement->row.id = id;
-  strcpy(statement->row.username, username);
-  strcpy(statement->row.email, email);
+  Token argument = next_token(&p, ")");
 
-  return PREPARE_SUCCESS;
+  for (uint32_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+    if (token_is(name, functions[i].name) &&
+        token_is(argument, functions[i].argument) && next_char(&p, ')')) {
+      statement->aggregate = functions[i].aggregate;
+      *input = p;
+      return PREPARE_SUCCESS;
+    }
+  }
+
+  return PREPARE_SYNTAX_ERROR;
+}
+
+/**
+ * @brief Parse "select", optionally followed by an aggregate, and then
+ * optionally by "where id = N", "where id between A and B",
+ * "where username = V" or "where email = V".
+ */
+PrepareResult prepare_select(StringBuffer* buffer, Statement* statement) {
+  const char* input = buffer->buffer;
+  statement->type = STATEMENT_SELECT;
+
+  if (!token_is(next_token(&input, ""), "select")) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  PrepareResult result = prepare_aggregate(&input, statement);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+
+  return prepare_where(input, statement, false, true);
+}
+
+/**
+ * @brief Parse "delete where id = N" or "delete where id between A and B".
+ */
+PrepareResult prepare_delete(StringBuffer* buffer, Statement* statement) {
+  const char* input = buffer->buffer;
+  statement->type = STATEMENT_DELETE;
+
+  if (!token_is(next_token(&input, ""), "delete")) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  return prepare_where(input, statement, true, false);
+}
+
+/**
+ * @brief Parse "create index on username" or "create index on email".
+ */
+PrepareResult prepare_create_index(StringBuffer* buffer,
+                                   Statement* statement) {
+  const char* input = buffer->buffer;
+  statement->type = STATEMENT_CREATE_INDEX;
+
+  if (!token_is(next_token(&input, ""), "create")) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  if (!token_is(next_token(&input, ""), "index") ||
+      !token_is(next_token(&input, ""), "on") ||
+      !parse_column_name(next_token(&input, ""), &statement->column)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  return at_end(input) ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
 }
 
 PrepareResult prepare_statement(StringBuffer* buffer, Statement* statement) {
-  if (strncmp(buffer->buffer, "insert", 6) == 0) {
+  const char* input = buffer->buffer;
+  Token keyword = next_token(&input, "(");
+
+  if (token_is(keyword, "insert")) {
     return prepare_insert(buffer, statement);
   }
 
-  if (strcmp(buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
+  if (token_is(keyword, "select")) {
+    return prepare_select(buffer, statement);
+  }
+
+  if (token_is(keyword, "delete")) {
+    return prepare_delete(buffer, statement);
+  }
+
+  if (token_is(keyword, "create")) {
+    return prepare_create_index(buffer, statement);
+  }
+
+  if (!at_end(input)) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+
+  if (token_is(keyword, "begin")) {
+    statement->type = STATEMENT_BEGIN;
+
+    return PREPARE_SUCCESS;
+  }
+
+  if (token_is(keyword, "commit")) {
+    statement->type = STATEMENT_COMMIT;
 
     return PREPARE_SUCCESS;
   }
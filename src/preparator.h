@@ -10,10 +10,19 @@ typedef enum {
   PREPARE_SYNTAX_ERROR,
   PREPARE_INPUT_TOO_LONG,
   PREPARE_NEGATIVE_ID,
+  PREPARE_ID_OUT_OF_RANGE,
 } PrepareResult;
 
 PrepareResult prepare_statement(StringBuffer* ib, Statement* statement);
 
 PrepareResult prepare_insert(StringBuffer* ib, Statement* statement);
 
+PrepareResult prepare_row(const char* input, Row* row);
+
+PrepareResult prepare_select(StringBuffer* ib, Statement* statement);
+
+PrepareResult prepare_delete(StringBuffer* ib, Statement* statement);
+
+PrepareResult prepare_create_index(StringBuffer* ib, Statement* statement);
+
 #endif /* PREPARATOR_H */
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+
+#include "readahead.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define READAHEAD_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef READAHEAD_URING
+
+static int readahead_enter(Readahead* ra, uint32_t to_submit,
+                           uint32_t min_complete, uint32_t flags) {
+  int ret;
+
+  do {
+    ret = syscall(__NR_io_uring_enter, ra->ring_fd, to_submit, min_complete,
+                  flags, NULL, 0);
+    ra->syscalls++;
+  } while (ret == -1 && errno == EINTR);
+
+  return ret;
+}
+
+/**
+ * @brief Map the submission and completion rings and the submission entries
+ * shared with the kernel. Returns false (leaving nothing mapped) on failure.
+ */
+static bool readahead_map(Readahead* ra, struct io_uring_params* p) {
+  ra->sq_ring_len = p->sq_off.array + p->sq_entries * sizeof(uint32_t);
+  ra->cq_ring_len =
+      p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+  ra->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+
+  bool single_mmap = p->features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    if (ra->cq_ring_len > ra->sq_ring_len) {
+      ra->sq_ring_len = ra->cq_ring_len;
+    }
+
+    ra->cq_ring_len = ra->sq_ring_len;
+  }
+
+  ra->sq_ring =
+      mmap(NULL, ra->sq_ring_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ra->ring_fd, IORING_OFF_SQ_RING);
+  if (ra->sq_ring == MAP_FAILED) {
+    return false;
+  }
+
+  ra->cq_ring = ra->sq_ring;
+  if (!single_mmap) {
+    ra->cq_ring = mmap(NULL, ra->cq_ring_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ra->ring_fd,
+                       IORING_OFF_CQ_RING);
+    if (ra->cq_ring == MAP_FAILED) {
+      munmap(ra->sq_ring, ra->sq_ring_len);
+      return false;
+    }
+  }
+
+  ra->sqes = mmap(NULL, ra->sqes_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ra->ring_fd, IORING_OFF_SQES);
+  if (ra->sqes == MAP_FAILED) {
+    if (!single_mmap) {
+      munmap(ra->cq_ring, ra->cq_ring_len);
+    }
+    munmap(ra->sq_ring, ra->sq_ring_len);
+    return false;
+  }
+
+  ra->sq_head = ra->sq_ring + p->sq_off.head;
+  ra->sq_tail = ra->sq_ring + p->sq_off.tail;
+  ra->sq_mask = *(uint32_t*)(ra->sq_ring + p->sq_off.ring_mask);
+  ra->sq_array = ra->sq_ring + p->sq_off.array;
+  ra->sq_entries = p->sq_entries;
+
+  ra->cq_head = ra->cq_ring + p->cq_off.head;
+  ra->cq_tail = ra->cq_ring + p->cq_off.tail;
+  ra->cq_mask = *(uint32_t*)(ra->cq_ring + p->cq_off.ring_mask);
+  ra->cqes = ra->cq_ring + p->cq_off.cqes;
+
+  return true;
+}
+
+#endif /* READAHEAD_URING */
+
+Readahead* readahead_open(uint32_t entries) {
+  Readahead* ra = malloc(sizeof(Readahead));
+  memset(ra, 0, sizeof(Readahead));
+  ra->ring_fd = -1;
+
+#ifdef READAHEAD_URING
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd < 0) {
+    return ra;
+  }
+
+  ra->ring_fd = ring_fd;
+  if (!readahead_map(ra, &params)) {
+    close(ring_fd);
+    ra->ring_fd = -1;
+  }
+#else
+  (void)entries;
+#endif
+
+  return ra;
+}
+
+void readahead_close(Readahead* ra) {
+  if (ra->ring_fd >= 0) {
+    munmap(ra->sqes, ra->sqes_len);
+    if (ra->cq_ring != ra->sq_ring) {
+      munmap(ra->cq_ring, ra->cq_ring_len);
+    }
+    munmap(ra->sq_ring, ra->sq_ring_len);
+    close(ra->ring_fd);
+  }
+
+  free(ra);
+}
+
+/**
+ * @brief Return whether reads can be queued, i.e. a ring was set up.
+ */
+bool readahead_async(Readahead* ra) { return ra->ring_fd >= 0; }
+
+/**
+ * @brief Queue a read of len bytes at offset into buf, identified by tag when
+ * it completes. Returns false if the ring is unavailable or full. Nothing
+ * reaches the kernel until readahead_submit.
+ */
+bool readahead_queue(Readahead* ra, int fd, void* buf, uint32_t len,
+                     off_t offset, uint64_t tag) {
+#ifdef READAHEAD_URING
+  if (ra->ring_fd < 0 || ra->in_flight >= ra->sq_entries) {
+    return false;
+  }
+
+  uint32_t tail = *ra->sq_tail;
+  uint32_t idx = tail & ra->sq_mask;
+  struct io_uring_sqe* sqe = (struct io_uring_sqe*)ra->sqes + idx;
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = tag;
+
+  ra->sq_array[idx] = idx;
+  __atomic_store_n(ra->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  ra->unsubmitted++;
+  ra->in_flight++;
+  return true;
+#else
+  (void)ra, (void)fd, (void)buf, (void)len, (void)offset, (void)tag;
+  return false;
+#endif
+}
+
+/**
+ * @brief Hand every queued read to the kernel with one system call.
+ */
+void readahead_submit(Readahead* ra) {
+#ifdef READAHEAD_URING
+  if (ra->unsubmitted == 0) {
+    return;
+  }
+
+  if (readahead_enter(ra, ra->unsubmitted, 0, 0) < 0) {
+    DIE("Error submitting reads: %d\n", errno);
+  }
+
+  ra->unsubmitted = 0;
+#else
+  (void)ra;
+#endif
+}
+
+/**
+ * @brief Return whether a completed read is waiting to be reaped.
+ */
+bool readahead_ready(Readahead* ra) {
+#ifdef READAHEAD_URING
+  return ra->ring_fd >= 0 &&
+         *ra->cq_head != __atomic_load_n(ra->cq_tail, __ATOMIC_ACQUIRE);
+#else
+  (void)ra;
+  return false;
+#endif
+}
+
+/**
+ * @brief Block until a queued read completes and return its tag, storing the
+ * byte count (or negated errno) in result.
+ */
+uint64_t readahead_wait(Readahead* ra, int32_t* result) {
+#ifdef READAHEAD_URING
+  if (ra->in_flight == 0) {
+    DIE("%s\n", "Waiting on a read that was never queued");
+  }
+
+  while (1) {
+    uint32_t head = *ra->cq_head;
+    uint32_t tail = __atomic_load_n(ra->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head != tail) {
+      struct io_uring_cqe* cqe =
+          (struct io_uring_cqe*)ra->cqes + (head & ra->cq_mask);
+      uint64_t tag = cqe->user_data;
+
+      *result = cqe->res;
+      __atomic_store_n(ra->cq_head, head + 1, __ATOMIC_RELEASE);
+      ra->in_flight--;
+
+      return tag;
+    }
+
+    if (readahead_enter(ra, ra->unsubmitted, 1, IORING_ENTER_GETEVENTS) < 0) {
+      DIE("Error waiting for reads: %d\n", errno);
+    }
+
+    ra->unsubmitted = 0;
+  }
+#else
+  (void)ra, (void)result;
+  DIE("%s\n", "Waiting on a read that was never queued");
+#endif
+}
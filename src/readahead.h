@@ -0,0 +1,59 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Submission queue depth requested from io_uring.
+ */
+#define READAHEAD_RING_ENTRIES 64
+
+/**
+ * @brief Asynchronous page reads through an io_uring, driven with raw system
+ * calls. When the kernel (or a sandbox) refuses to set up a ring, ring_fd is
+ * -1 and callers fall back to synchronous reads plus posix_fadvise.
+ */
+typedef struct {
+  int ring_fd;
+
+  void* sq_ring;
+  size_t sq_ring_len;
+  void* cq_ring;
+  size_t cq_ring_len;
+  void* sqes;
+  size_t sqes_len;
+
+  uint32_t* sq_head;
+  uint32_t* sq_tail;
+  uint32_t sq_mask;
+  uint32_t* sq_array;
+  uint32_t sq_entries;
+
+  uint32_t* cq_head;
+  uint32_t* cq_tail;
+  uint32_t cq_mask;
+  void* cqes;
+
+  uint32_t unsubmitted;  // queued but not yet handed to the kernel
+  uint32_t in_flight;    // submitted or queued, not yet reaped
+  uint64_t syscalls;     // io_uring_enter calls since open
+} Readahead;
+
+Readahead* readahead_open(uint32_t entries);
+
+void readahead_close(Readahead* ra);
+
+bool readahead_async(Readahead* ra);
+
+bool readahead_queue(Readahead* ra, int fd, void* buf, uint32_t len,
+                     off_t offset, uint64_t tag);
+
+void readahead_submit(Readahead* ra);
+
+bool readahead_ready(Readahead* ra);
+
+uint64_t readahead_wait(Readahead* ra, int32_t* result);
+
+#endif /* READAHEAD_H */
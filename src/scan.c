@@ -0,0 +1,213 @@
+#include "scan.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "btree.h"
+#include "common.h"
+
+// 0 until set: one thread per online processor
+static uint32_t scan_threads = 0;
+
+void scan_set_threads(uint32_t threads) { scan_threads = threads; }
+
+static uint32_t scan_max_threads(Pager* pager) {
+  uint32_t threads = scan_threads;
+
+  if (threads == 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? online : 1;
+  }
+
+  if (threads > SCAN_MAX_THREADS) {
+    threads = SCAN_MAX_THREADS;
+  }
+
+  // every thread pins frames, and the pool must never run out of free ones
+  if (pager->mode == PAGER_MODE_BUFFERED &&
+      threads > pager->num_frames / SCAN_FRAMES_PER_THREAD) {
+    threads = pager->num_frames / SCAN_FRAMES_PER_THREAD;
+  }
+
+  return threads ? threads : 1;
+}
+
+/*
+Each separator key in an internal node is the largest id of the subtree to its
+left, so cutting a scan there splits it along subtree boundaries. The root's
+separators are used, along with those of the level below when the root has too
+few children to go around. Internal nodes only change with the table latched
+exclusively, so they are pinned rather than latched. Returns how many keys were
+stored, and whether each one separates two leaves.
+*/
+static uint32_t scan_separators(Pager* pager, void* root, uint32_t threads,
+                                Arena* arena, uint64_t** keys,
+                                bool* between_leaves) {
+  uint32_t num_children = *internal_node_num_keys(root) + 1;
+  void* first_child = pager_pin(pager, *internal_node_child(pager, root, 0));
+  bool leaf_children = get_node_type(first_child) == NODE_LEAF;
+  pager_unpin(pager, first_child);
+
+  bool expand = !leaf_children && num_children < threads;
+  uint32_t per_child = expand ? internal_node_max_cells(pager) + 1 : 1;
+  *keys = arena_alloc(arena, num_children * per_child * sizeof(uint64_t));
+  *between_leaves = leaf_children;
+  uint32_t count = 0;
+
+  for (uint32_t i = 0; i < num_children; i++) {
+    if (expand) {
+      void* child = pager_pin(pager, *internal_node_child(pager, root, i));
+      uint32_t num_keys = *internal_node_num_keys(child);
+
+      for (uint32_t j = 0; j < num_keys; j++) {
+        (*keys)[count++] = *internal_node_key(child, j);
+      }
+
+      if (i == 0) {
+        void* grandchild =
+            pager_pin(pager, *internal_node_child(pager, child, 0));
+        *between_leaves = get_node_type(grandchild) == NODE_LEAF;
+        pager_unpin(pager, grandchild);
+      }
+
+      pager_unpin(pager, child);
+    }
+
+    if (i < num_children - 1) {
+      (*keys)[count++] = *internal_node_key(root, i);
+    }
+  }
+
+  return count;
+}
+
+/**
+ * @brief Split [id_min, id_max] into ranges covering about as many subtrees
+ * each, one per scanning thread. Returns the number of ranges, which is 1 when
+ * the table is too small, or the machine too narrow, to be worth splitting.
+ */
+uint32_t scan_split(Table* table, uint64_t id_min, uint64_t id_max,
+                    Arena* arena, ScanRange* ranges) {
+  Pager* pager = table->pager;
+  uint32_t threads = scan_max_threads(pager);
+  uint32_t count = 0;
+  uint64_t* keys = NULL;
+  bool between_leaves = true;
+
+  ranges[0].id_min = id_min;
+  ranges[0].id_max = id_max;
+
+  if (threads == 1) {
+    return 1;
+  }
+
+  table_lock(table, LATCH_SHARED);
+  void* root = pager_pin(pager, table->root_page_num);
+
+  if (get_node_type(root) == NODE_INTERNAL) {
+    count = scan_separators(pager, root, threads, arena, &keys,
+                            &between_leaves);
+  }
+
+  pager_unpin(pager, root);
+  table_unlock(table);
+
+  // keep the cuts that fall inside the range; they are already in order
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (keys[i] >= id_min && keys[i] < id_max) {
+      keys[kept++] = keys[i];
+    }
+  }
+
+  uint32_t n = kept + 1 < threads ? kept + 1 : threads;
+  if (between_leaves && kept + 1 < SCAN_MIN_LEAVES) {
+    n = 1;
+  }
+
+  for (uint32_t i = 0; i < n - 1; i++) {
+    uint64_t cut = keys[(i + 1) * kept / n];
+
+    ranges[i].id_max = cut;
+    ranges[i + 1].id_min = cut + 1;
+    ranges[i + 1].id_max = id_max;
+  }
+
+  return n;
+}
+
+/*
+Visit the worker's rows in id order. A worker whose rows are piling up waits
+between leaves, where it can drop its latches: waiting with the table latched
+could hold up a writer, and behind the writer every other scan, including the
+ones whose rows must be taken before this worker's. It then seeks past the
+last row it visited, in whichever leaf now holds it.
+*/
+static void scan_rows(const ScanWorker* worker) {
+  Row row;
+  Cursor cursor;
+
+  table_scan(worker->table, worker->range.id_min, &cursor);
+
+  while (!(cursor.end)) {
+    deserialize_row(cursor_value(&cursor), &row);
+    if (row.id > worker->range.id_max) {
+      break;
+    }
+
+    worker->visit(worker->state, &row);
+
+    uint32_t page_num = cursor.page_num;
+    cursor_advance(&cursor);
+
+    if (worker->backlogged && !(cursor.end) && cursor.page_num != page_num &&
+        worker->backlogged(worker->state)) {
+      cursor_close(&cursor);
+      worker->wait(worker->state);
+      table_scan(worker->table, row.id + 1, &cursor);
+    }
+  }
+
+  cursor_close(&cursor);
+}
+
+/**
+ * @brief Visit every row with an id in the range, in id order. The table is
+ * latched shared while a leaf is being read, so this may run on any number of
+ * threads at once, alongside a writer.
+ */
+void scan_range(Table* table, ScanRange range, ScanVisitor visit, void* state) {
+  ScanWorker worker = {
+      .table = table,
+      .range = range,
+      .visit = visit,
+      .state = state,
+  };
+
+  scan_rows(&worker);
+}
+
+static void* scan_run(void* arg) {
+  ScanWorker* worker = arg;
+
+  scan_rows(worker);
+
+  if (worker->finish) {
+    worker->finish(worker->state);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Scan the worker's range on a thread of its own; see scan_join.
+ */
+void scan_start(ScanWorker* worker) {
+  int error = pthread_create(&worker->thread, NULL, scan_run, worker);
+
+  if (error) {
+    DIE("Unable to start scan thread: %d\n", error);
+  }
+}
+
+void scan_join(ScanWorker* worker) { pthread_join(worker->thread, NULL); }
@@ -0,0 +1,62 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "pager.h"
+
+/**
+ * @brief Most threads one scan is split across.
+ */
+#define SCAN_MAX_THREADS 16
+
+/**
+ * @brief Fewest leaves a scan must span before it is split; below this,
+ * starting threads costs more than it saves.
+ */
+#define SCAN_MIN_LEAVES 32
+
+/**
+ * @brief Buffer pool frames each scanning thread may pin at once: the nodes
+ * of its descent, or its leaf and the two levels above it while reading ahead.
+ */
+#define SCAN_FRAMES_PER_THREAD 4
+
+/**
+ * @brief Called with each row of a range, in id order, on the thread scanning
+ * that range.
+ */
+typedef void (*ScanVisitor)(void* state, Row* row);
+
+typedef struct {
+  uint64_t id_min;
+  uint64_t id_max;  // inclusive
+} ScanRange;
+
+typedef struct {
+  Table* table;
+  ScanRange range;
+  ScanVisitor visit;
+  void (*finish)(void* state);  // if set, called once the range is done
+  // if set, asked between leaves whether whoever takes the rows has fallen
+  // behind; the scan then lets go of its latches and calls wait
+  bool (*backlogged)(void* state);
+  void (*wait)(void* state);
+  void* state;
+  pthread_t thread;
+} ScanWorker;
+
+void scan_set_threads(uint32_t threads);
+
+uint32_t scan_split(Table* table, uint64_t id_min, uint64_t id_max,
+                    Arena* arena, ScanRange* ranges);
+
+void scan_range(Table* table, ScanRange range, ScanVisitor visit, void* state);
+
+void scan_start(ScanWorker* worker);
+
+void scan_join(ScanWorker* worker);
+
+#endif /* SCAN_H */
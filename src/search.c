@@ -0,0 +1,155 @@
+#include "search.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Halve [*lo, *hi) until at most width keys remain that may hold the
+ * first key >= key.
+ */
+static void search_narrow(const uint64_t* keys, uint32_t* lo, uint32_t* hi,
+                          uint64_t key, uint32_t width) {
+  while (*hi - *lo > width) {
+    uint32_t mid = *lo + (*hi - *lo) / 2;
+
+    if (keys[mid] >= key) {
+      *hi = mid;
+    } else {
+      *lo = mid + 1;
+    }
+  }
+}
+
+static uint32_t search_scalar(const uint64_t* keys, uint32_t num_keys,
+                              uint64_t key) {
+  uint32_t lo = 0;
+  uint32_t hi = num_keys;
+
+  search_narrow(keys, &lo, &hi, key, 0);
+
+  return lo;
+}
+
+#ifdef SEARCH_X86
+
+// SSE4.2 and AVX2 only compare signed lanes; flipping the sign bit of both
+// sides orders unsigned keys the same way
+#define SEARCH_SIGN_BIT ((long long)0x8000000000000000u)
+
+/*
+Within a sorted window, the number of keys below the target is the offset of
+the first key >= target, so the window is finished by counting compare hits
+rather than branching on them.
+*/
+__attribute__((target("sse4.2"))) static uint32_t search_sse42(
+    const uint64_t* keys, uint32_t num_keys, uint64_t key) {
+  uint32_t lo = 0;
+  uint32_t hi = num_keys;
+
+  search_narrow(keys, &lo, &hi, key, SEARCH_LINEAR_KEYS);
+
+  const __m128i sign = _mm_set1_epi64x(SEARCH_SIGN_BIT);
+  const __m128i target = _mm_xor_si128(_mm_set1_epi64x(key), sign);
+  uint32_t below = 0;
+  uint32_t i = lo;
+
+  for (; i + 2 <= hi; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(keys + i));
+    __m128i lt = _mm_cmpgt_epi64(target, _mm_xor_si128(v, sign));
+    below += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(lt)));
+  }
+
+  for (; i < hi; i++) {
+    below += keys[i] < key;
+  }
+
+  return lo + below;
+}
+
+__attribute__((target("avx2"))) static uint32_t search_avx2(
+    const uint64_t* keys, uint32_t num_keys, uint64_t key) {
+  uint32_t lo = 0;
+  uint32_t hi = num_keys;
+
+  search_narrow(keys, &lo, &hi, key, SEARCH_LINEAR_KEYS);
+
+  const __m256i sign = _mm256_set1_epi64x(SEARCH_SIGN_BIT);
+  const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(key), sign);
+  uint32_t below = 0;
+  uint32_t i = lo;
+
+  for (; i + 4 <= hi; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(keys + i));
+    __m256i lt = _mm256_cmpgt_epi64(target, _mm256_xor_si256(v, sign));
+    below += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(lt)));
+  }
+
+  for (; i < hi; i++) {
+    below += keys[i] < key;
+  }
+
+  return lo + below;
+}
+
+#endif /* SEARCH_X86 */
+
+static SearchKernel search_select(void) {
+#ifdef SEARCH_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return search_avx2;
+  }
+
+  if (__builtin_cpu_supports("sse4.2")) {
+    return search_sse42;
+  }
+#endif
+
+  return search_scalar;
+}
+
+static SearchKernel search_kernel = NULL;
+static pthread_once_t search_kernel_once = PTHREAD_ONCE_INIT;
+
+static void search_init(void) { search_kernel = search_select(); }
+
+/**
+ * @brief Return the index of the first of num_keys sorted keys that is >= key,
+ * or num_keys if there is none. The kernel is chosen for the running CPU on
+ * first use, by whichever thread gets there first.
+ */
+uint32_t key_search(const uint64_t* keys, uint32_t num_keys, uint64_t key) {
+  pthread_once(&search_kernel_once, search_init);
+
+  return search_kernel(keys, num_keys, key);
+}
+
+/**
+ * @brief Fill kernels with every kernel the running CPU supports, scalar
+ * first, and return how many there are, so they can be checked against each
+ * other.
+ */
+uint32_t search_kernels(SearchKernelInfo kernels[SEARCH_MAX_KERNELS]) {
+  uint32_t count = 0;
+
+  kernels[count++] = (SearchKernelInfo){"scalar", search_scalar};
+
+#ifdef SEARCH_X86
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse4.2")) {
+    kernels[count++] = (SearchKernelInfo){"sse4.2", search_sse42};
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[count++] = (SearchKernelInfo){"avx2", search_avx2};
+  }
+#endif
+
+  return count;
+}
@@ -0,0 +1,30 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Windows at most this many keys wide are finished with a linear
+ * vector scan instead of further halving.
+ */
+#define SEARCH_LINEAR_KEYS 32
+
+typedef uint32_t (*SearchKernel)(const uint64_t*, uint32_t, uint64_t);
+
+/**
+ * @brief A key_search implementation and the instruction set it needs.
+ */
+typedef struct {
+  const char* name;
+  SearchKernel search;
+} SearchKernelInfo;
+
+/**
+ * @brief Most kernels search_kernels can return.
+ */
+#define SEARCH_MAX_KERNELS 3
+
+uint32_t key_search(const uint64_t* keys, uint32_t num_keys, uint64_t key);
+uint32_t search_kernels(SearchKernelInfo kernels[SEARCH_MAX_KERNELS]);
+
+#endif /* SEARCH_H */
@@ -1,16 +1,45 @@
 #ifndef STATEMENT_H
 #define STATEMENT_H
 
+#include "arena.h"
 #include "pager.h"
 
 typedef enum {
   STATEMENT_INSERT,
   STATEMENT_SELECT,
+  STATEMENT_DELETE,
+  STATEMENT_BEGIN,
+  STATEMENT_COMMIT,
+  STATEMENT_CREATE_INDEX,
 } StatementType;
 
+typedef enum {
+  AGGREGATE_NONE,
+  AGGREGATE_COUNT,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_SUM,
+} Aggregate;
+
 typedef struct {
   StatementType type;
-  Row row;
+  // rows of an insert; the array is kept and reused by later statements
+  Row* rows;
+  uint32_t num_rows;
+  uint32_t rows_capacity;
+  // rows of an insert batch skipped because their id was already taken
+  uint32_t duplicates;
+  // inclusive id range of a select or delete
+  uint64_t id_min;
+  uint64_t id_max;
+  // a select's "where column = value", or the column an index is created on
+  bool by_column;
+  Column column;
+  char value[COLUMN_EMAIL_SIZE + 1];
+  // what a select computes over its range instead of returning rows
+  Aggregate aggregate;
+  // scratch memory for executing the statement, reset once it is done
+  Arena arena;
 } Statement;
 
 #endif
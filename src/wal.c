@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "pager.h"
+
+static const char WAL_SUFFIX[] = "-wal";
+
+static size_t wal_frame_size(Wal* wal) {
+  return sizeof(WalFrameHeader) + wal->page_size;
+}
+
+static off_t wal_frame_offset(Wal* wal, uint32_t frame_num) {
+  return (off_t)sizeof(WalHeader) + (off_t)frame_num * wal_frame_size(wal);
+}
+
+/**
+ * @brief Fletcher-style checksum over the frame header (sans checksum) and
+ * page image; cheap enough to run on every frame.
+ */
+static uint32_t wal_checksum(Wal* wal, WalFrameHeader* header, void* page) {
+  uint32_t s0 = header->page_num;
+  uint32_t s1 = header->db_num_pages + s0;
+  s0 += header->salt + s1;
+
+  uint32_t* words = page;
+  for (uint32_t i = 0; i < wal->page_size / sizeof(uint32_t); i += 2) {
+    s0 += words[i] + s1;
+    s1 += words[i + 1] + s0;
+  }
+
+  return s0 ^ s1;
+}
+
+static void wal_index_set(Wal* wal, uint32_t page_num, uint32_t frame_num) {
+  if (page_num >= wal->page_frames_len) {
+    uint32_t len = wal->page_frames_len ? wal->page_frames_len : 64;
+    while (len <= page_num) {
+      len *= 2;
+    }
+
+    wal->page_frames = realloc(wal->page_frames, len * sizeof(uint32_t));
+    for (uint32_t i = wal->page_frames_len; i < len; i++) {
+      wal->page_frames[i] = WAL_NOT_FOUND;
+    }
+
+    wal->page_frames_len = len;
+  }
+
+  wal->page_frames[page_num] = frame_num;
+}
+
+static void wal_write_header(Wal* wal) {
+  WalHeader header = {
+      .magic = WAL_MAGIC,
+      .version = WAL_VERSION,
+      .page_size = wal->page_size,
+      .salt = wal->salt,
+  };
+
+  if (pwrite(wal->fd, &header, sizeof(header), 0) != sizeof(header)) {
+    DIE("Error writing log header: %d\n", errno);
+  }
+
+  wal->bytes_written += sizeof(header);
+  wal->syscalls++;
+}
+
+/**
+ * @brief Scan the log for the last intact commit frame and index every frame
+ * up to it. Torn or uncommitted frames past that point are truncated away.
+ */
+static void wal_recover(Wal* wal) {
+  void* page = malloc(wal->page_size);
+  WalFrameHeader frame;
+  uint32_t num_frames = 0;
+
+  while (1) {
+    off_t offset = wal_frame_offset(wal, num_frames);
+
+    if (pread(wal->fd, &frame, sizeof(frame), offset) != sizeof(frame) ||
+        pread(wal->fd, page, wal->page_size, offset + sizeof(frame)) !=
+            wal->page_size) {
+      break;
+    }
+
+    wal->bytes_read += wal_frame_size(wal);
+    wal->syscalls += 2;
+
+    if (frame.salt != wal->salt ||
+        frame.checksum != wal_checksum(wal, &frame, page)) {
+      break;
+    }
+
+    num_frames++;
+
+    if (frame.db_num_pages) {
+      wal->committed_frames = num_frames;
+      wal->db_num_pages = frame.db_num_pages;
+    }
+  }
+
+  for (uint32_t i = 0; i < wal->committed_frames; i++) {
+    if (pread(wal->fd, &frame, sizeof(frame), wal_frame_offset(wal, i)) !=
+        sizeof(frame)) {
+      DIE("Error reading log: %d\n", errno);
+    }
+
+    wal->bytes_read += sizeof(frame);
+    wal->syscalls++;
+    wal_index_set(wal, frame.page_num, i);
+  }
+
+  wal->num_frames = wal->committed_frames;
+  if (ftruncate(wal->fd, wal_frame_offset(wal, wal->num_frames)) == -1) {
+    DIE("Error truncating log: %d\n", errno);
+  }
+
+  wal->syscalls++;
+
+  free(page);
+}
+
+Wal* wal_open(const char* db_filename, uint32_t page_size) {
+  Wal* wal = malloc(sizeof(Wal));
+  wal->page_size = page_size;
+  wal->filename = malloc(strlen(db_filename) + sizeof(WAL_SUFFIX));
+  strcpy(wal->filename, db_filename);
+  strcat(wal->filename, WAL_SUFFIX);
+
+  if ((wal->fd = open(wal->filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR)) ==
+      -1) {
+    DIE("%s\n", "Unable to open log file");
+  }
+
+  wal->num_frames = 0;
+  wal->committed_frames = 0;
+  wal->db_num_pages = 0;
+  wal->page_frames = NULL;
+  wal->page_frames_len = 0;
+  wal->bytes_read = 0;
+  wal->bytes_written = 0;
+  wal->syscalls = 1;
+
+  WalHeader header;
+  bool valid = pread(wal->fd, &header, sizeof(header), 0) == sizeof(header) &&
+               header.magic == WAL_MAGIC && header.version == WAL_VERSION &&
+               header.page_size == page_size;
+
+  if (valid) {
+    wal->salt = header.salt;
+    wal_recover(wal);
+  } else {
+    wal->salt = (uint32_t)time(NULL);
+    wal_reset(wal);
+  }
+
+  return wal;
+}
+
+void wal_close(Wal* wal, bool remove) {
+  if (close(wal->fd) == -1) {
+    DIE("%s\n", "Error closing log file");
+  }
+
+  if (remove && unlink(wal->filename) == -1) {
+    DIE("Error removing log file: %d\n", errno);
+  }
+
+  free(wal->page_frames);
+  free(wal->filename);
+  free(wal);
+}
+
+/**
+ * @brief Append page images to the log. If commit_num_pages is non-zero the
+ * last frame is marked as a commit recording that database size. The frames
+ * are not durable until wal_sync.
+ */
+void wal_append(Wal* wal, uint32_t* page_nums, void** pages, uint32_t count,
+                uint32_t commit_num_pages) {
+  const uint32_t frames_per_write = IOV_MAX / 2;
+  WalFrameHeader headers[frames_per_write];
+  struct iovec iov[frames_per_write * 2];
+
+  for (uint32_t start = 0; start < count; start += frames_per_write) {
+    uint32_t n = count - start;
+    if (n > frames_per_write) {
+      n = frames_per_write;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t idx = start + i;
+      bool last = idx == count - 1;
+
+      headers[i].page_num = page_nums[idx];
+      headers[i].db_num_pages = last ? commit_num_pages : 0;
+      headers[i].salt = wal->salt;
+      headers[i].checksum = wal_checksum(wal, &headers[i], pages[idx]);
+
+      iov[i * 2].iov_base = &headers[i];
+      iov[i * 2].iov_len = sizeof(WalFrameHeader);
+      iov[i * 2 + 1].iov_base = pages[idx];
+      iov[i * 2 + 1].iov_len = wal->page_size;
+    }
+
+    ssize_t expected = (ssize_t)(n * wal_frame_size(wal));
+    if (pwritev(wal->fd, iov, n * 2, wal_frame_offset(wal, wal->num_frames)) !=
+        expected) {
+      DIE("Error writing log: %d\n", errno);
+    }
+
+    wal->bytes_written += expected;
+    wal->syscalls++;
+
+    for (uint32_t i = 0; i < n; i++) {
+      wal_index_set(wal, page_nums[start + i], wal->num_frames + i);
+    }
+
+    wal->num_frames += n;
+  }
+
+  if (commit_num_pages) {
+    wal->committed_frames = wal->num_frames;
+    wal->db_num_pages = commit_num_pages;
+  }
+}
+
+void wal_sync(Wal* wal) {
+  if (fdatasync(wal->fd) == -1) {
+    DIE("Error syncing log: %d\n", errno);
+  }
+
+  wal->syscalls++;
+}
+
+/**
+ * @brief Return the latest frame holding the given page, or WAL_NOT_FOUND if
+ * the page has not been logged since the last checkpoint.
+ */
+uint32_t wal_find_frame(Wal* wal, uint32_t page_num) {
+  if (page_num >= wal->page_frames_len) {
+    return WAL_NOT_FOUND;
+  }
+
+  return wal->page_frames[page_num];
+}
+
+void wal_read_frame(Wal* wal, uint32_t frame_num, void* dest) {
+  off_t offset = wal_frame_offset(wal, frame_num) + sizeof(WalFrameHeader);
+
+  if (pread(wal->fd, dest, wal->page_size, offset) != wal->page_size) {
+    DIE("Error reading log: %d\n", errno);
+  }
+
+  wal->bytes_read += wal->page_size;
+  wal->syscalls++;
+}
+
+/**
+ * @brief Empty the log once its contents are safely in the database file.
+ * Bumping the salt invalidates any stale frames a crash might leave behind,
+ * so the new header is synced before any frame can be written under it.
+ */
+void wal_reset(Wal* wal) {
+  wal->salt++;
+  wal_write_header(wal);
+
+  if (ftruncate(wal->fd, sizeof(WalHeader)) == -1) {
+    DIE("Error truncating log: %d\n", errno);
+  }
+
+  wal->syscalls++;
+  wal_sync(wal);
+
+  wal->num_frames = 0;
+  wal->committed_frames = 0;
+
+  for (uint32_t i = 0; i < wal->page_frames_len; i++) {
+    wal->page_frames[i] = WAL_NOT_FOUND;
+  }
+}
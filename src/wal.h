@@ -0,0 +1,80 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Write-ahead log kept next to the database file as "<db>-wal".
+ *
+ * The log is a header followed by frames, each a full page image with a small
+ * header. A frame whose db_num_pages is non-zero marks a commit: every frame up
+ * to and including it is durable once the log is synced. Frames after the last
+ * commit belong to a transaction that never finished and are ignored by
+ * recovery.
+ */
+#define WAL_MAGIC 0x4c574250  // "PBWL"
+#define WAL_VERSION 1
+
+/**
+ * @brief Number of commits that may share one fsync of the log.
+ */
+#define WAL_GROUP_COMMIT_MAX 1000
+
+/**
+ * @brief Log size, in frames, past which the log is checkpointed into the
+ * database file and reset.
+ */
+#define WAL_CHECKPOINT_FRAMES 4096
+
+#define WAL_NOT_FOUND UINT32_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t page_size;
+  uint32_t salt;
+} WalHeader;
+
+typedef struct {
+  uint32_t page_num;
+  uint32_t db_num_pages;  // non-zero on commit frames
+  uint32_t salt;
+  uint32_t checksum;
+} WalFrameHeader;
+
+typedef struct {
+  int fd;
+  char* filename;
+  uint32_t salt;
+  uint32_t page_size;  // the database's, which every frame carries
+
+  uint32_t num_frames;        // frames in the log, committed or not
+  uint32_t committed_frames;  // frames up to and including the last commit
+  uint32_t db_num_pages;      // database size recorded by the last commit
+
+  // page number -> index of the latest frame holding that page
+  uint32_t* page_frames;
+  uint32_t page_frames_len;
+
+  uint64_t bytes_read;  // since open, for pager_stats
+  uint64_t bytes_written;
+  uint64_t syscalls;
+} Wal;
+
+Wal* wal_open(const char* db_filename, uint32_t page_size);
+
+void wal_close(Wal* wal, bool remove);
+
+void wal_append(Wal* wal, uint32_t* page_nums, void** pages, uint32_t count,
+                uint32_t commit_num_pages);
+
+void wal_sync(Wal* wal);
+
+uint32_t wal_find_frame(Wal* wal, uint32_t page_num);
+
+void wal_read_frame(Wal* wal, uint32_t frame_num, void* dest);
+
+void wal_reset(Wal* wal);
+
+#endif /* WAL_H */
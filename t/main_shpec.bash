@@ -28,13 +28,15 @@ DB_FILE='test.db'
 EXECUTED="Executedstatement#"
 
 MAX_CAPACITY=13
+# enough rows to split the root internal node at least once
+MANY_ROWS=1000000
 EMAIL='user@username.com'
 USERNAME='user'
 
 describe 'pageboy'
 
-  alias setup="rm $DB_FILE &> /dev/null && touch $DB_FILE"
-  alias teardown="rm $DB_FILE"
+  alias setup="rm -f $DB_FILE-wal; rm $DB_FILE &> /dev/null && touch $DB_FILE"
+  alias teardown="rm -f $DB_FILE $DB_FILE-wal"
 
   it 'inserts and retrieves a row'
     result=$(run_command_sequence "insert 1 $USERNAME $EMAIL" 'select')
@@ -101,20 +103,331 @@ describe 'pageboy'
     assert equal "Provided negative id\n##" "$result"
   ti
 
+  it 'prints an error message when provided an id too large for 64 bits'
+    result=$( (run_command_sequence "insert 18446744073709551616 $USERNAME $EMAIL") 2>&1)
+    assert equal "Provided id is out of range\n##" "$result"
+  ti
+
+  it 'stores ids beyond 32 bits'
+    result=$(run_command_sequence 'insert (18446744073709551615 a a), (4294967296 b b)' 'select' 'select where id = 4294967296')
+    assert equal "#$EXECUTED(4294967296,b,b)(18446744073709551615,a,a)$EXECUTED(4294967296,b,b)$EXECUTED" "$result"
+  ti
+
+  it 'inserts a batch of rows in one statement'
+    result=$(run_command_sequence 'insert (3 c c), (1 a a),(2 b b)' 'select')
+    assert equal "#$EXECUTED(1,a,a)(2,b,b)(3,c,c)$EXECUTED" "$result"
+  ti
+
+  it 'keeps the rest of a batch when some of its ids are duplicates'
+    result=$( (run_command_sequence 'insert 2 x x' 'insert (1 a a), (2 b b), (1 c c)' 'insert (1 a a), (2 b b), (1 c c)' 'select') 2>&1)
+    assert equal "Skipped 2 duplicate keys\nSkipped 3 duplicate keys\n#$EXECUTED$EXECUTED$EXECUTED(1,a,a)(2,x,x)$EXECUTED" "$result"
+  ti
+
+  it 'counts a batch with duplicate ids as executed when input is piped'
+    result=$(printf 'insert 2 x x\ninsert (1 a a), (2 b b), (3 c c)\nselect\n' |
+      ./$BIN_NAME $DB_FILE 2>&1)
+    assert equal "Skipped 1 duplicate keys
+(1, a, a)
+(2, x, x)
+(3, c, c)
+Executed 3 statements, 0 failed" "$result"
+  ti
+
   it 'persists data between executions'
     run_command_sequence "insert 1 $USERNAME $EMAIL"
     result=$(run_command_sequence 'select')
     assert equal "#(1,$USERNAME,$EMAIL)$EXECUTED" "$result"
   ti
 
+  it 'splits internal nodes when inserting many sequential keys'
+    seq 1 $MANY_ROWS | insert_ids
+
+    ids=$(select_ids)
+    assert equal "$MANY_ROWS" "$(wc -l <<< "$ids")"
+    assert equal "$(seq 1 $MANY_ROWS)" "$ids"
+  ti
+
+  it 'splits internal nodes when inserting many random keys'
+    seq 1 $MANY_ROWS | shuf | insert_ids
+
+    ids=$(select_ids)
+    assert equal "$MANY_ROWS" "$(wc -l <<< "$ids")"
+    assert equal "$(seq 1 $MANY_ROWS)" "$ids"
+  ti
+
+  it 'packs short rows into variable-length cells'
+    seq 1 1000 | insert_ids
+
+    # fixed-width cells would need at least 1000 / 13 leaves
+    assert lt "$(stat -c %s $DB_FILE)" "$((40 * 4096))"
+    assert equal "$(seq 1 1000)" "$(select_ids)"
+  ti
+
+  it 'selects a single row by id'
+    seq 1 100 | insert_ids
+
+    result=$(run_command_sequence 'select where id = 50' 'select where id = 500')
+    assert equal "#(50,user50,user50@username.com)$EXECUTED$EXECUTED" "$result"
+  ti
+
+  it 'selects the rows whose ids fall in a range'
+    seq 1 100 | shuf | insert_ids
+
+    result=$(printf 'select where id between 42 and 58\n.exit\n' | ./$BIN_NAME $DB_FILE | grep -o '([0-9]*,' | tr -d '(,')
+    assert equal "$(seq 42 58)" "$result"
+  ti
+
+  it 'computes count, min, max and sum of ids'
+    seq 1 1000 | shuf | insert_ids
+
+    result=$(run_command_sequence 'select count(*)' 'select min(id)' 'select max(id)' 'select sum(id) where id between 10 and 20' 'select count(*) where id between 990 and 5000')
+    assert equal "#(1000)$EXECUTED(1)$EXECUTED(1000)$EXECUTED(165)$EXECUTED(11)$EXECUTED" "$result"
+  ti
+
+  it 'prints an error message when a sum overflows 64 bits'
+    result=$( (run_command_sequence 'insert (18446744073709551615 a a), (1 b b)' 'select sum(id)') 2>&1)
+    assert equal "Sum out of range\n#$EXECUTED#" "$result"
+  ti
+
+  it 'returns no value for the min, max or sum of no rows'
+    result=$(run_command_sequence 'select count(*)' 'select min(id)' 'select max(id) where id = 7' 'select sum(id)')
+    assert equal "#(0)$EXECUTED(NULL)$EXECUTED(NULL)$EXECUTED(NULL)$EXECUTED" "$result"
+  ti
+
+  it 'finds nothing for absent ids and finds them once inserted'
+    seq 1 2 9999 | insert_ids
+
+    result=$(run_command_sequence 'select where id = 500' 'select count(*) where id = 500' 'delete where id = 500' 'insert 500 a b' 'select where id = 500' 'select count(*) where id = 501')
+    assert equal "#$EXECUTED(0)$EXECUTED$EXECUTED$EXECUTED(500,a,b)$EXECUTED(1)$EXECUTED" "$result"
+  ti
+
+  it 'looks rows up by username and email through their indexes'
+    result=$(run_command_sequence 'insert (1 ann a@x), (2 bob b@x), (3 ann c@x)' 'create index on username' 'create index on email' 'select where username = ann' 'select where email = b@x' 'select count(*) where username = ann')
+    assert equal "#$EXECUTED$EXECUTED$EXECUTED(1,ann,a@x)(3,ann,c@x)$EXECUTED(2,bob,b@x)$EXECUTED(2)$EXECUTED" "$result"
+  ti
+
+  it 'keeps an index up to date as rows are inserted and deleted'
+    result=$(run_command_sequence 'create index on email' 'insert (1 ann a@x), (2 bob a@x)' 'delete where id = 1' 'insert 3 cy a@x' 'select where email = a@x')
+    assert equal "#$EXECUTED$EXECUTED$EXECUTED$EXECUTED(2,bob,a@x)(3,cy,a@x)$EXECUTED" "$result"
+  ti
+
+  it 'selects by a column without an index and refuses a second index on it'
+    result=$( (run_command_sequence 'insert (1 ann a@x), (2 bob b@x)' 'select where username = bob' 'create index on username' 'create index on username') 2>&1)
+    assert equal "Index already exists
+#$EXECUTED(2,bob,b@x)$EXECUTED$EXECUTED#" "$result"
+  ti
+
+  it 'prints an error message when a select has a malformed where clause'
+    result=$( (run_command_sequence 'select where id between 1') 2>&1)
+    assert equal "Syntax error. Could not parse statement\n##" "$result"
+  ti
+
+  it 'selects rows as csv via the meta command .mode'
+    result=$(run_command_sequence 'insert 1 a,b c"d' '.mode csv' 'select')
+    assert equal "#$EXECUTED#1,\"a,b\",\"c\"\"d\"$EXECUTED" "$result"
+  ti
+
+  it 'selects rows as tsv via the meta command .mode'
+    result=$(printf 'insert 1 a\\b c\n.mode tsv\nselect\n.exit\n' |
+      ./pageboy $DB_FILE | grep -cF $'1\ta\\\\b\tc')
+    assert equal "1" "$result"
+  ti
+
+  it 'selects length-prefixed rows via the meta command .mode binary'
+    result=$(printf 'insert 1 a b\n.mode binary\nselect\n.exit\n' |
+      ./pageboy $DB_FILE | od -An -tx1 | tr -d '[:space:]')
+    assert match "$result" '0c00000001000000000000000161016200000000'
+  ti
+
+  it 'refuses a file without a database header'
+    head -c 4096 /dev/zero > $DB_FILE
+    result=$(printf '.exit\n' | ./$BIN_NAME $DB_FILE 2>&1)
+    assert equal "Not a database, or one in format version 1 (32-bit ids)" "$result"
+  ti
+
+  it 'prints an error message when given an unknown output mode'
+    result=$(run_command_sequence '.mode xml' 2>&1)
+    assert equal "Usage: .mode text|csv|tsv|binary\n##" "$result"
+  ti
+
+  it 'deletes a single row by id'
+    seq 1 3 | insert_ids
+
+    result=$(run_command_sequence 'delete where id = 2' 'select')
+    assert equal "#$EXECUTED(1,user1,user1@username.com)(3,user3,user3@username.com)$EXECUTED" "$result"
+  ti
+
+  it 'deletes the rows whose ids fall in a range, merging emptied leaves'
+    seq 1 100000 | shuf | insert_ids
+    printf 'delete where id between 1000 and 99000\n.exit\n' | ./$BIN_NAME $DB_FILE > /dev/null
+
+    assert equal "$(seq 1 999; seq 99001 100000)" "$(select_ids)"
+  ti
+
+  it 'reuses pages freed by deletes'
+    seq 1 20000 | insert_ids
+    size=$(stat -c %s $DB_FILE)
+
+    printf 'delete where id between 1 and 20000\n.exit\n' | ./$BIN_NAME $DB_FILE > /dev/null
+    seq 1 20000 | insert_ids
+
+    assert equal "$size" "$(stat -c %s $DB_FILE)"
+    assert equal "$(seq 1 20000)" "$(select_ids)"
+  ti
+
+  it 'prints an error message when a delete has no where clause'
+    result=$( (run_command_sequence 'delete') 2>&1)
+    assert equal "Syntax error. Could not parse statement\n##" "$result"
+  ti
+
+  it 'scans a table much larger than the buffer pool'
+    seq 1 100000 | shuf | insert_ids
+
+    ids=$(printf 'select\n.exit\n' | ./$BIN_NAME --cache-pages 16 $DB_FILE | grep -o '([0-9]*,' | tr -d '(,')
+    assert equal "$(seq 1 100000)" "$ids"
+  ti
+
+  it 'selects rows in id order when the scan is split across threads'
+    seq 1 100000 | shuf | insert_ids
+
+    ids=$(printf 'select\nselect where id between 500 and 99500\n.exit\n' | ./$BIN_NAME --threads 4 $DB_FILE | grep -o '([0-9]*,' | tr -d '(,')
+    assert equal "$(seq 1 100000; seq 500 99500)" "$ids"
+  ti
+
+  it 'prints the usage message when an option is given a malformed count'
+    for count in abc 12x -1 99999999999999; do
+      result=$(./$BIN_NAME --cache-pages "$count" $DB_FILE < /dev/null 2>&1)
+      assert equal "Usage: $BIN_NAME [--batch | --interactive] [--cache-pages N] [--mmap] [--no-wal] [--threads N] <database>" "$result"
+    done
+  ti
+
+  it 'writes a split scan out without buffering the rows of every thread'
+    rows=200000
+    padding=$(printf 'x%.0s' {1..200})
+    import_file=$(mktemp)
+    seq 1 $rows | awk -v padding="$padding" '{ print $1 " user" $1 " " padding $1 }' > "$import_file"
+    printf '.import %s\n.exit\n' "$import_file" | ./$BIN_NAME $DB_FILE > /dev/null
+    rm "$import_file"
+
+    # about 46 MB of rows; keep the session open once they are written to
+    # read its peak resident set
+    input=$(mktemp -u)
+    output=$(mktemp)
+    mkfifo "$input"
+    ./$BIN_NAME --threads 4 $DB_FILE < "$input" > "$output" &
+    pid=$!
+    exec 3> "$input"
+    printf 'select\n' >&3
+    until grep -q "^($rows," "$output"; do sleep 0.1; done
+    peak_kb=$(awk '/^VmHWM/ { print $2 }' /proc/$pid/status)
+    exec 3>&-
+    wait $pid
+    rm "$input" "$output"
+
+    assert lt "$peak_kb" 16384
+  ti
+
+  it 'reads and writes the same file in mmap mode'
+    printf 'insert 1 %s %s\n.exit\n' "$USERNAME" "$EMAIL" | ./$BIN_NAME --mmap $DB_FILE > /dev/null
+
+    result=$(run_command_sequence 'select')
+    assert equal "#(1,$USERNAME,$EMAIL)$EXECUTED" "$result"
+  ti
+
+  it 'runs piped input as a batch, reporting only errors and a summary'
+    result=$(printf 'insert 1 a a\ninsert 1 b b\ninsert 2 c c\nselect\n' |
+      ./$BIN_NAME $DB_FILE 2>&1)
+    assert equal "Duplicate key
+(1, a, a)
+(2, c, c)
+Executed 3 statements, 1 failed" "$result"
+  ti
+
+  it 'commits rows inserted inside a transaction'
+    result=$(run_command_sequence 'begin' "insert 1 $USERNAME $EMAIL" 'commit' 'select')
+    assert equal "#$EXECUTED$EXECUTED$EXECUTED(1,$USERNAME,$EMAIL)$EXECUTED" "$result"
+  ti
+
+  it 'prints an error message when committing without a transaction'
+    result=$( (run_command_sequence 'commit') 2>&1)
+    assert equal "No transaction open\n##" "$result"
+  ti
+
+  it 'recovers committed rows from the log when a session dies'
+    # keep input open so the session is killed before it can close cleanly
+    { printf 'insert 1 %s %s\n' "$USERNAME" "$EMAIL"; sleep 5; } |
+      ./$BIN_NAME $DB_FILE &> /dev/null &
+    sleep 1
+    kill -9 $!
+    wait $! 2> /dev/null
+
+    result=$(run_command_sequence 'select')
+    assert equal "#(1,$USERNAME,$EMAIL)$EXECUTED" "$result"
+  ti
+
+  it 'bulk loads unsorted rows via the meta command .import'
+    import_file=$(mktemp)
+    seq 1 $MANY_ROWS | shuf | awk '{ print $1 " user" $1 " user" $1 "@username.com" }' > "$import_file"
+
+    result=$(printf '.import %s\n.exit\n' "$import_file" | ./$BIN_NAME $DB_FILE)
+    rm "$import_file"
+    assert equal "Imported $MANY_ROWS rows" "$result"
+
+    ids=$(select_ids)
+    assert equal "$(seq 1 $MANY_ROWS)" "$ids"
+  ti
+
+  it 'skips duplicate keys via the meta command .import'
+    import_file=$(mktemp)
+    printf '2 %s %s\n1 %s %s\n2 b b\n' "$USERNAME" "$EMAIL" "$USERNAME" "$EMAIL" > "$import_file"
+
+    result=$( (run_command_sequence ".import $import_file" 'select') 2>&1)
+    rm "$import_file"
+    assert equal "Skipped 1 duplicate keys\n#Imported2rows#(1,$USERNAME,$EMAIL)(2,$USERNAME,$EMAIL)$EXECUTED" "$result"
+  ti
+
+  it 'prints an error message when .import is given a bad fill percent'
+    import_file=$(mktemp)
+    printf '1 %s %s\n' "$USERNAME" "$EMAIL" > "$import_file"
+
+    result=$( (run_command_sequence ".import $import_file 50abc" ".import $import_file xyz" ".import $import_file 101" 'select') 2>&1)
+    rm "$import_file"
+    assert equal "Usage: .import <file> [fill percent]\nUsage: .import <file> [fill percent]\nUsage: .import <file> [fill percent]\n####$EXECUTED" "$result"
+  ti
+
   it 'prints the btree structure via the meta command .btree'
     result=$(run_command_sequence '.btree')
-    assert equal "#TODO#" "$result"
+    assert equal "#height1level0pages1leaffill0.0%#" "$result"
+  ti
+
+  it 'prints pager and btree counters via the meta command .stats'
+    result=$(run_command_sequence "insert 1 $USERNAME $EMAIL" 'select where id = 1' '.stats json')
+    assert equal '"btree_descents":1,' "$(echo "$result" | grep -o '"btree_descents":[0-9]*,')"
+
+    result=$( (run_command_sequence '.stats xml') 2>&1)
+    assert equal "Usage: .stats [text|json]\n##" "$result"
   ti
 
   it 'prints internal configurations and settings via the meta command .settings'
     result=$(run_command_sequence '.settings')
-    assert equal "#TODO#" "$result"
+    assert equal "#format_version3page_size4096pages2rows0modebufferedcache_pages1024walon#" "$result"
+  ti
+
+  it 'stores rows in larger pages set via the meta command .settings'
+    run_command_sequence '.settings page_size 65536' > /dev/null
+    seq 1 20000 | shuf | insert_ids
+
+    # the number of pages depends on the order the rows arrived in
+    result=$(run_command_sequence 'select count(*)' '.settings' | sed 's/pages[0-9]*//')
+    assert equal "#(20000)${EXECUTED}format_version3page_size65536rows20000modebufferedcache_pages1024walon#" "$result"
+
+    ids=$(select_ids)
+    assert equal "$(seq 1 20000)" "$ids"
+  ti
+
+  it 'refuses to change the page size of a database holding rows'
+    result=$( (run_command_sequence "insert 1 $USERNAME $EMAIL" '.settings page_size 16384' '.settings page_size 1000') 2>&1)
+    assert equal "Page size can only be changed on an empty database\nUsage: .settings [page_size 4096|8192|16384|32768|65536]\n#$EXECUTED##" "$result"
   ti
 
 
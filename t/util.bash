@@ -24,7 +24,7 @@ run_command_sequence() {
 $(for_each "${@}")
 .exit
 END
-) | ./$BIN_NAME test.db)
+) | ./$BIN_NAME --interactive test.db)
 
   data=${data//pageboy/#}
 
@@ -42,3 +42,16 @@ for_each () {
     echo "$item";
   done
 }
+
+# feed a stream of ids (one per line) to a session as inserts
+insert_ids() {
+  (
+    awk '{ print "insert " $1 " user" $1 " user" $1 "@username.com" }'
+    echo '.exit'
+  ) | ./$BIN_NAME test.db > /dev/null
+}
+
+# print the ids returned by a full select, one per line
+select_ids() {
+  printf 'select\n.exit\n' | ./$BIN_NAME test.db | grep -o '([0-9]*,' | tr -d '(,'
+}